@@ -16,6 +16,15 @@ std::vector<double> getOutput(int id) {
     return mdr.getLabelOutput(id);
 }
 
+MnistDataReader testReader("MNIST_DATA/t10k-labels.idx1-ubyte", "MNIST_DATA/t10k-images.idx3-ubyte");
+
+std::vector<double> getTestInput(int id) {
+    return testReader.getImageInput(id);
+}
+std::vector<double> getTestOutput(int id) {
+    return testReader.getLabelOutput(id);
+}
+
 int main () {
     // Training MNIST Network
     cout << "Training Network - MNIST\n";
@@ -32,6 +41,20 @@ int main () {
     NeuralNetwork::WriteToBinaryFile(mnistNetwork, "mnist_network.bin");
     NeuralNetwork::WriteToTextFile(mnistNetwork, "mnist_network.txt");
 
+    // Test the network on the held-out t10k set
+    testReader.open();
+    evaluation::EvaluationResult result = evaluation::evaluate(mnistNetwork, 0, testReader.getNumOfItems(), getTestInput, getTestOutput);
+    testReader.close();
+
+    cout << "\nTest cost: " << result.loss << "\tTest accuracy: " << result.accuracy << "\n";
+    cout << "Confusion matrix (rows: expected digit, columns: predicted digit):\n";
+    for (unsigned int i = 0; i < result.confusionMatrix.size(); i++) {
+        for (unsigned int j = 0; j < result.confusionMatrix[i].size(); j++) {
+            cout << result.confusionMatrix[i][j] << "\t";
+        }
+        cout << "\n";
+    }
+
     cout << "\nDone!!\n";
 
     return 0;
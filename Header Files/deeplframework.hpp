@@ -1,6 +1,12 @@
 #pragma once
 #include "activationfunctions.hpp"
+#include "threadpool.hpp"
 #include "neuronnetwork.hpp"
 #include "neuronlayer.hpp"
+#include "denselayer.hpp"
+#include "incrementalinference.hpp"
 #include "training.hpp"
+#include "mixedprecisiontraining.hpp"
+#include "evaluation.hpp"
 #include "mnistdatareader.hpp"
+#include "pruning.hpp"
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+
+#include "neuronlayer.hpp"
+
+namespace deeplframework {
+	// Row-major copy of a layer's parameters, used by the batched trainer and by evaluation
+	struct DenseLayerParameters {
+		int numOfNeurons;
+		int numOfInputs;
+		// numOfNeurons x numOfInputs
+		std::vector<double> weights;
+		std::vector<double> biases;
+		double(*activationFunction)(double);
+		double(*activationFunctionDerivative)(double);
+
+		DenseLayerParameters(NeuronLayer layer) {
+			this->numOfNeurons = layer.getNumOfNeurons();
+			this->numOfInputs = layer.getNumOfInputs();
+			this->biases = layer.getBiases();
+			this->activationFunction = layer.activationFunction;
+			this->activationFunctionDerivative = layer.activationFunctionDerivative;
+
+			std::vector<std::vector<double>> layerWeights = layer.getWeights();
+			for (int n = 0; n < numOfNeurons; n++) {
+				weights.insert(weights.end(), layerWeights[n].begin(), layerWeights[n].end());
+			}
+		}
+		NeuronLayer toNeuronLayer() const {
+			std::vector<std::vector<double>> layerWeights;
+			for (int n = 0; n < numOfNeurons; n++) {
+				layerWeights.push_back(std::vector<double>(weights.begin() + n * numOfInputs, weights.begin() + (n + 1) * numOfInputs));
+			}
+
+			NeuronLayer layer(numOfNeurons, layerWeights, biases);
+			layer.activationFunction = activationFunction;
+			layer.activationFunctionDerivative = activationFunctionDerivative;
+			return layer;
+		}
+	};
+
+	// Runs numOfSamples samples through the layers. Inputs is row-major, one row per sample. Rows firstRow to
+	// firstRow + numOfSamples - 1 of weightedSums[l] and activations[l] receive the results of layer l, one row per sample
+	void forwardPass(const std::vector<DenseLayerParameters>& layers, const double* inputs, int numOfSamples,
+		std::vector<std::vector<double>>& weightedSums, std::vector<std::vector<double>>& activations, int firstRow = 0) {
+		for (unsigned int l = 0; l < layers.size(); l++) {
+			const DenseLayerParameters& layer = layers[l];
+			const double* previous = (l == 0) ? inputs : &activations[l - 1][firstRow * layers[l - 1].numOfNeurons];
+			double* sums = &weightedSums[l][firstRow * layer.numOfNeurons];
+			double* outputs = &activations[l][firstRow * layer.numOfNeurons];
+
+			for (int s = 0; s < numOfSamples; s++) {
+				const double* input = previous + s * layer.numOfInputs;
+				for (int n = 0; n < layer.numOfNeurons; n++) {
+					double sum = NeuronLayer::calculateWeightedSum(&layer.weights[n * layer.numOfInputs], input, layer.numOfInputs, layer.biases[n]);
+					sums[s * layer.numOfNeurons + n] = sum;
+					outputs[s * layer.numOfNeurons + n] = layer.activationFunction(sum);
+				}
+			}
+		}
+	}
+}
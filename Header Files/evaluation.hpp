@@ -0,0 +1,144 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <future>
+
+#include "neuronnetwork.hpp"
+#include "denselayer.hpp"
+#include "threadpool.hpp"
+
+namespace deeplframework {
+	namespace evaluation {
+		struct EvaluationResult {
+			// Mean squared error per sample, the same cost the trainers print
+			double loss = 0;
+			// Fraction of samples where the largest output matches the largest expected output
+			double accuracy = 0;
+			int numOfSamples = 0;
+			// confusionMatrix[expected][predicted] is the number of samples of class expected that were predicted as class predicted
+			std::vector<std::vector<int>> confusionMatrix;
+		};
+
+		// Index of the largest output, the class a classifier predicts. Ties go to the first index. Every accuracy the framework
+		// reports is measured with this
+		int getPredictedClass(const double* outputs, int numOfOutputs) {
+			return std::max_element(outputs, outputs + numOfOutputs) - outputs;
+		}
+
+		// Summed squared difference of one sample's outputs and expected outputs, the MSE cost the trainers minimize
+		double squaredError(const double* outputs, const double* expectedOutputs, int numOfOutputs) {
+			double error = 0;
+			for (int o = 0; o < numOfOutputs; o++) {
+				double difference = outputs[o] - expectedOutputs[o];
+				error += difference * difference;
+			}
+			return error;
+		}
+
+		// Runs samples begin to end - 1 of a loaded batch and adds their results to result. Inputs and expectedOutputs are
+		// row-major, one row per sample
+		void evaluateSlice(const std::vector<DenseLayerParameters>& layers, const std::vector<double>& inputs, const std::vector<double>& expectedOutputs,
+			int begin, int end, EvaluationResult& result) {
+			const int numOfInputs = layers.front().numOfInputs;
+			const int numOfOutputs = layers.back().numOfNeurons;
+			const int numOfSamples = end - begin;
+
+			std::vector<std::vector<double>> weightedSums;
+			std::vector<std::vector<double>> activations;
+			for (unsigned int l = 0; l < layers.size(); l++) {
+				weightedSums.push_back(std::vector<double>(numOfSamples * layers[l].numOfNeurons));
+				activations.push_back(std::vector<double>(numOfSamples * layers[l].numOfNeurons));
+			}
+			forwardPass(layers, &inputs[begin * numOfInputs], numOfSamples, weightedSums, activations);
+
+			for (int s = 0; s < numOfSamples; s++) {
+				const double* outputs = &activations.back()[s * numOfOutputs];
+				const double* expected = &expectedOutputs[(begin + s) * numOfOutputs];
+				result.loss += squaredError(outputs, expected, numOfOutputs);
+
+				int predicted = getPredictedClass(outputs, numOfOutputs);
+				int actual = getPredictedClass(expected, numOfOutputs);
+				result.confusionMatrix[actual][predicted]++;
+				if (predicted == actual) result.accuracy++;
+				result.numOfSamples++;
+			}
+		}
+
+		// Runs the model on samples firstSample to firstSample + numOfSamples - 1. Samples are loaded batchSize at a time on the
+		// calling thread, so the data functions do not need to be thread safe, and each batch is split between the workers of the
+		// runtime thread pool
+		EvaluationResult evaluate(NeuralNetwork model, const int firstSample, const int numOfSamples, std::vector<double>(*inputDataGen)(int dataIndex),
+			std::vector<double>(*expectedOutputDataGen)(int dataIndex), const int batchSize = 1024) {
+			std::vector<NeuronLayer> modelLayers = model.getLayers();
+			if (modelLayers.empty()) {
+				throw std::runtime_error("Network has no layers");
+			}
+			runtime::ThreadPool& pool = runtime::getDefaultPool();
+
+			std::vector<DenseLayerParameters> layers;
+			for (unsigned int l = 0; l < modelLayers.size(); l++) {
+				layers.push_back(DenseLayerParameters(modelLayers[l]));
+			}
+
+			const int numOfInputs = model.getNumOfInputs();
+			const int numOfOutputs = modelLayers.back().getNumOfNeurons();
+
+			EvaluationResult total;
+			total.confusionMatrix.assign(numOfOutputs, std::vector<int>(numOfOutputs, 0));
+
+			std::vector<EvaluationResult> partialResults(std::max(1, pool.getNumOfThreads()));
+			std::vector<double> inputs;
+			std::vector<double> expectedOutputs;
+
+			for (int first = firstSample; first < firstSample + numOfSamples; first += batchSize) {
+				int last = std::min(first + batchSize, firstSample + numOfSamples);
+
+				inputs.clear();
+				expectedOutputs.clear();
+				for (int sample = first; sample < last; sample++) {
+					std::vector<double> sampleInputs = inputDataGen(sample);
+					std::vector<double> sampleExpectedOutputs = expectedOutputDataGen(sample);
+					if ((int)sampleInputs.size() != numOfInputs || (int)sampleExpectedOutputs.size() != numOfOutputs) {
+						throw std::runtime_error("Evaluation data does not match the network shape");
+					}
+					inputs.insert(inputs.end(), sampleInputs.begin(), sampleInputs.end());
+					expectedOutputs.insert(expectedOutputs.end(), sampleExpectedOutputs.begin(), sampleExpectedOutputs.end());
+				}
+
+				// Split the batch into one contiguous slice per worker
+				int count = last - first;
+				int numOfSlices = std::min<int>(partialResults.size(), count);
+				pool.parallelFor(0, numOfSlices, 1, [&](int firstSlice, int lastSlice) {
+					for (int t = firstSlice; t < lastSlice; t++) {
+						partialResults[t] = EvaluationResult();
+						partialResults[t].confusionMatrix.assign(numOfOutputs, std::vector<int>(numOfOutputs, 0));
+						evaluateSlice(layers, inputs, expectedOutputs, (int)((long long)count * t / numOfSlices), (int)((long long)count * (t + 1) / numOfSlices), partialResults[t]);
+					}
+				});
+
+				for (int t = 0; t < numOfSlices; t++) {
+					total.loss += partialResults[t].loss;
+					total.accuracy += partialResults[t].accuracy;
+					total.numOfSamples += partialResults[t].numOfSamples;
+					for (int i = 0; i < numOfOutputs; i++) {
+						for (int j = 0; j < numOfOutputs; j++) total.confusionMatrix[i][j] += partialResults[t].confusionMatrix[i][j];
+					}
+				}
+			}
+
+			if (total.numOfSamples > 0) {
+				total.loss /= total.numOfSamples;
+				total.accuracy /= total.numOfSamples;
+			}
+			return total;
+		}
+
+		// Same as evaluate, but runs in the background on a copy of the model, so it can be called during training. The data
+		// functions are called from the background thread, so they must not share state (e.g. a MnistDataReader) with the training data
+		std::future<EvaluationResult> evaluateAsync(NeuralNetwork model, const int firstSample, const int numOfSamples, std::vector<double>(*inputDataGen)(int dataIndex),
+			std::vector<double>(*expectedOutputDataGen)(int dataIndex), const int batchSize = 1024) {
+			return std::async(std::launch::async, evaluate, model, firstSample, numOfSamples, inputDataGen, expectedOutputDataGen, batchSize);
+		}
+	}
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace deeplframework {
+	namespace precision {
+		// 16 bit brain floating point: the sign and 8 bit exponent of a float with a 7 bit mantissa. Has the same range as
+		// float, so small gradients do not underflow. Conversions are bit operations, so no hardware support is needed
+		struct bfloat16 {
+			uint16_t bits;
+
+			bfloat16() {
+				this->bits = 0;
+			}
+			bfloat16(float value) {
+				this->bits = fromFloat(value);
+			}
+			operator float() const {
+				return toFloat(bits);
+			}
+
+			// Rounds to the nearest value, ties to even
+			static uint16_t fromFloat(float value) {
+				uint32_t f;
+				std::memcpy(&f, &value, sizeof(f));
+
+				// Keep NaNs from rounding into infinity
+				if ((f & 0x7fffffff) > 0x7f800000) return (uint16_t)((f >> 16) | 0x0040);
+
+				f += 0x7fff + ((f >> 16) & 1);
+				return (uint16_t)(f >> 16);
+			}
+			static float toFloat(uint16_t bits) {
+				uint32_t f = (uint32_t)bits << 16;
+				float value;
+				std::memcpy(&value, &f, sizeof(value));
+				return value;
+			}
+		};
+
+		// IEEE 754 half precision: 5 bit exponent and 10 bit mantissa. More precise than bfloat16 but overflows above 65504,
+		// so training with it needs loss scaling. Uses the F16C instructions when compiled with them (e.g. -mf16c)
+		struct float16 {
+			uint16_t bits;
+
+			float16() {
+				this->bits = 0;
+			}
+			float16(float value) {
+				this->bits = fromFloat(value);
+			}
+			operator float() const {
+				return toFloat(bits);
+			}
+
+			// Rounds to the nearest value, ties to even. Values too large for half precision become infinity
+			static uint16_t fromFloat(float value) {
+#ifdef __F16C__
+				return _cvtss_sh(value, 0);
+#else
+				uint32_t f;
+				std::memcpy(&f, &value, sizeof(f));
+
+				uint16_t sign = (uint16_t)((f >> 16) & 0x8000);
+				uint32_t absolute = f & 0x7fffffff;
+
+				// NaN, then infinity and overflow
+				if (absolute > 0x7f800000) return sign | 0x7e00;
+				if (absolute >= 0x47800000) return sign | 0x7c00;
+
+				// Normal numbers: rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits. A carry out of
+				// the mantissa correctly moves on to the next exponent, or to infinity
+				if (absolute >= 0x38800000) {
+					uint32_t h = absolute - 0x38000000;
+					h += 0xfff + ((h >> 13) & 1);
+					return sign | (uint16_t)(h >> 13);
+				}
+
+				// Too small even for a subnormal half
+				if (absolute < 0x33000000) return sign;
+
+				// Subnormal numbers: value = mantissa * 2^-24
+				uint32_t exponent = absolute >> 23;
+				uint32_t mantissa = (absolute & 0x7fffff) | 0x800000;
+				uint32_t shift = 126 - exponent;
+				uint32_t h = mantissa >> shift;
+				uint32_t remainder = mantissa & ((1u << shift) - 1);
+				uint32_t halfway = 1u << (shift - 1);
+				if (remainder > halfway || (remainder == halfway && (h & 1))) h++;
+				return sign | (uint16_t)h;
+#endif
+			}
+			static float toFloat(uint16_t bits) {
+#ifdef __F16C__
+				return _cvtsh_ss(bits);
+#else
+				uint32_t sign = (uint32_t)(bits & 0x8000) << 16;
+				uint32_t exponent = (bits >> 10) & 0x1f;
+				uint32_t mantissa = bits & 0x3ff;
+
+				uint32_t f;
+				if (exponent == 0) {
+					// Zero or subnormal
+					float value = std::ldexp((float)mantissa, -24);
+					return (sign) ? -value : value;
+				}
+				else if (exponent == 31) {
+					f = sign | 0x7f800000 | (mantissa << 13);
+				}
+				else {
+					f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+				}
+
+				float value;
+				std::memcpy(&value, &f, sizeof(value));
+				return value;
+#endif
+			}
+		};
+	}
+}
@@ -0,0 +1,197 @@
+#pragma once
+#include <vector>
+#include <stdexcept>
+
+#include "neuronnetwork.hpp"
+
+namespace deeplframework {
+	// Runs a network on inputs that only differ from the previous inputs in a few elements, e.g. when changing single pixels
+	// of an image. Every layer keeps its weighted sums from the last run and adds weight * change for each changed input,
+	// which costs O(changed inputs x neurons) instead of O(inputs x neurons). Only the outputs of a layer that changed are
+	// passed on to the next layer, and a layer with too many changed inputs is recalculated in full instead
+	class IncrementalNetwork {
+	private:
+		struct CachedLayer {
+			int numOfNeurons;
+			int numOfInputs;
+			// Transposed weights, numOfInputs x numOfNeurons, so the weights of one input are next to each other
+			std::vector<double> weightColumns;
+			std::vector<double> biases;
+			std::vector<double> weightedSums;
+			std::vector<double> outputs;
+			double(*activationFunction)(double);
+		};
+
+		std::vector<CachedLayer> layers;
+		std::vector<double> lastInputs;
+		bool hasRun;
+		int numOfUpdatesSinceFullRun;
+		int fullRunInterval;
+		double maxChangedFraction;
+
+		// Index and change of every input of a layer that changed
+		std::vector<int> changedIndexes;
+		std::vector<double> changes;
+		std::vector<int> nextChangedIndexes;
+		std::vector<double> nextChanges;
+
+		void calculateLayer(CachedLayer& layer, const std::vector<double>& layerInputs) {
+			layer.weightedSums = layer.biases;
+			for (int i = 0; i < layer.numOfInputs; i++) {
+				if (layerInputs[i] == 0) continue;
+
+				const double* column = &layer.weightColumns[i * layer.numOfNeurons];
+				for (int n = 0; n < layer.numOfNeurons; n++) {
+					layer.weightedSums[n] += column[n] * layerInputs[i];
+				}
+			}
+		}
+
+		std::vector<double> runFull() {
+			for (unsigned int l = 0; l < layers.size(); l++) {
+				calculateLayer(layers[l], (l == 0) ? lastInputs : layers[l - 1].outputs);
+				for (int n = 0; n < layers[l].numOfNeurons; n++) {
+					layers[l].outputs[n] = layers[l].activationFunction(layers[l].weightedSums[n]);
+				}
+			}
+			hasRun = true;
+			numOfUpdatesSinceFullRun = 0;
+			return layers.back().outputs;
+		}
+
+		// Passes the changes in changedIndexes and changes through the network. lastInputs must already hold the new inputs
+		std::vector<double> propagateChanges() {
+			for (unsigned int l = 0; l < layers.size() && !changedIndexes.empty(); l++) {
+				CachedLayer& layer = layers[l];
+
+				if (changedIndexes.size() > maxChangedFraction * layer.numOfInputs) {
+					calculateLayer(layer, (l == 0) ? lastInputs : layers[l - 1].outputs);
+				}
+				else {
+					for (unsigned int c = 0; c < changedIndexes.size(); c++) {
+						const double* column = &layer.weightColumns[changedIndexes[c] * layer.numOfNeurons];
+						double change = changes[c];
+						for (int n = 0; n < layer.numOfNeurons; n++) {
+							layer.weightedSums[n] += column[n] * change;
+						}
+					}
+				}
+
+				// Outputs that did not change (e.g. ReLU neurons that stay at 0) are not passed on
+				nextChangedIndexes.clear();
+				nextChanges.clear();
+				for (int n = 0; n < layer.numOfNeurons; n++) {
+					double output = layer.activationFunction(layer.weightedSums[n]);
+					if (output != layer.outputs[n]) {
+						nextChangedIndexes.push_back(n);
+						nextChanges.push_back(output - layer.outputs[n]);
+						layer.outputs[n] = output;
+					}
+				}
+				changedIndexes.swap(nextChangedIndexes);
+				changes.swap(nextChanges);
+			}
+			return layers.back().outputs;
+		}
+
+	public:
+		// Rounding errors build up in the cached sums, so every fullRunInterval updates the network is run in full. Layers
+		// where more than maxChangedFraction of the inputs changed are recalculated in full
+		IncrementalNetwork(NeuralNetwork network, int fullRunInterval = 1000, double maxChangedFraction = 0.25) {
+			std::vector<NeuronLayer> networkLayers = network.getLayers();
+			if (networkLayers.empty()) {
+				throw std::runtime_error("Network has no layers");
+			}
+
+			for (unsigned int l = 0; l < networkLayers.size(); l++) {
+				CachedLayer layer;
+				layer.numOfNeurons = networkLayers[l].getNumOfNeurons();
+				layer.numOfInputs = networkLayers[l].getNumOfInputs();
+				layer.biases = networkLayers[l].getBiases();
+				layer.activationFunction = networkLayers[l].activationFunction;
+				layer.weightedSums.assign(layer.numOfNeurons, 0);
+				layer.outputs.assign(layer.numOfNeurons, 0);
+
+				std::vector<std::vector<double>> weights = networkLayers[l].getWeights();
+				layer.weightColumns.resize(layer.numOfInputs * layer.numOfNeurons);
+				for (int n = 0; n < layer.numOfNeurons; n++) {
+					for (int i = 0; i < layer.numOfInputs; i++) {
+						layer.weightColumns[i * layer.numOfNeurons + n] = weights[n][i];
+					}
+				}
+				layers.push_back(layer);
+			}
+
+			this->lastInputs.assign(network.getNumOfInputs(), 0);
+			this->hasRun = false;
+			this->numOfUpdatesSinceFullRun = 0;
+			this->fullRunInterval = fullRunInterval;
+			this->maxChangedFraction = maxChangedFraction;
+		}
+
+		// Same result as NeuralNetwork::run, up to rounding. Only the inputs that differ from the previous call are recalculated
+		std::vector<double> run(const std::vector<double>& inputs) {
+			if (inputs.size() != lastInputs.size()) {
+				throw std::runtime_error("Neuron outputs vector is invalid");
+			}
+			if (!hasRun || ++numOfUpdatesSinceFullRun >= fullRunInterval) {
+				lastInputs = inputs;
+				return runFull();
+			}
+
+			changedIndexes.clear();
+			changes.clear();
+			for (unsigned int i = 0; i < inputs.size(); i++) {
+				if (inputs[i] != lastInputs[i]) {
+					changedIndexes.push_back(i);
+					changes.push_back(inputs[i] - lastInputs[i]);
+					lastInputs[i] = inputs[i];
+				}
+			}
+			return propagateChanges();
+		}
+
+		// Sets inputs[inputIndexes[k]] to values[k], keeping the other inputs from the previous call, and returns the network
+		// outputs. Avoids comparing every input like run does. The first call runs the network on all zero inputs apart from these
+		std::vector<double> update(const std::vector<int>& inputIndexes, const std::vector<double>& values) {
+			if (inputIndexes.size() != values.size()) {
+				throw std::runtime_error("Number of input indexes and values does not match");
+			}
+			for (unsigned int k = 0; k < inputIndexes.size(); k++) {
+				if (inputIndexes[k] < 0 || inputIndexes[k] >= (int)lastInputs.size()) {
+					throw std::runtime_error("Input index is invalid");
+				}
+			}
+			if (!hasRun || ++numOfUpdatesSinceFullRun >= fullRunInterval) {
+				for (unsigned int k = 0; k < inputIndexes.size(); k++) lastInputs[inputIndexes[k]] = values[k];
+				return runFull();
+			}
+
+			changedIndexes.clear();
+			changes.clear();
+			for (unsigned int k = 0; k < inputIndexes.size(); k++) {
+				int i = inputIndexes[k];
+				if (values[k] != lastInputs[i]) {
+					changedIndexes.push_back(i);
+					changes.push_back(values[k] - lastInputs[i]);
+					lastInputs[i] = values[k];
+				}
+			}
+			return propagateChanges();
+		}
+
+		// Next run or update recalculates the whole network
+		void reset() {
+			hasRun = false;
+		}
+		std::vector<double> getInputs() {
+			return lastInputs;
+		}
+		std::vector<double> getOutputs() {
+			return layers.back().outputs;
+		}
+		std::vector<double> getRecordedOutput(unsigned int layerIndex, bool beforeActivationFunction = false) {
+			return (beforeActivationFunction) ? layers[layerIndex].weightedSums : layers[layerIndex].outputs;
+		}
+	};
+}
@@ -0,0 +1,343 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <ctime>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <atomic>
+#include <type_traits>
+
+#include "neuronnetwork.hpp"
+#include "training.hpp"
+#include "threadpool.hpp"
+#include "halfprecision.hpp"
+
+namespace deeplframework {
+	namespace backpropogationTraining {
+		struct MixedPrecisionSettings {
+			// Output deltas are multiplied by this before the backward pass and the gradient is divided by it before the update,
+			// so small deltas do not flush to zero in float16. bfloat16 has the range of float and works with 1
+			float initialLossScale = 1;
+			// When a delta overflows, the update is skipped and the loss scale halved. After this many updates without an
+			// overflow the loss scale is doubled. 0 never increases it. -1 uses 2000 if initialLossScale is not 1 and 0 otherwise,
+			// so bfloat16 training with the default scale keeps it at 1
+			int lossScaleGrowthInterval = -1;
+			// Training throws once the loss scale is halved below this, since the deltas overflow without any scaling
+			float minLossScale = 1.0f / 1024;
+		};
+
+		// Parameters of one layer for mse_fit_mixed_precision. Updates are made to the float master copy, which is then
+		// rounded into the StorageType copy used by the forward and backward passes
+		template <typename StorageType>
+		struct MixedPrecisionLayer {
+			int numOfNeurons;
+			int numOfInputs;
+			// numOfNeurons x numOfInputs, row-major
+			std::vector<float> masterWeights;
+			std::vector<float> biases;
+			std::vector<StorageType> weights;
+			double(*activationFunction)(double);
+			double(*activationFunctionDerivative)(double);
+
+			MixedPrecisionLayer(NeuronLayer layer) {
+				this->numOfNeurons = layer.getNumOfNeurons();
+				this->numOfInputs = layer.getNumOfInputs();
+				this->activationFunction = layer.activationFunction;
+				this->activationFunctionDerivative = layer.activationFunctionDerivative;
+
+				std::vector<double> layerBiases = layer.getBiases();
+				biases.assign(layerBiases.begin(), layerBiases.end());
+
+				std::vector<std::vector<double>> layerWeights = layer.getWeights();
+				for (int n = 0; n < numOfNeurons; n++) {
+					masterWeights.insert(masterWeights.end(), layerWeights[n].begin(), layerWeights[n].end());
+				}
+				weights.assign(masterWeights.begin(), masterWeights.end());
+			}
+			NeuronLayer toNeuronLayer() const {
+				std::vector<std::vector<double>> layerWeights;
+				for (int n = 0; n < numOfNeurons; n++) {
+					layerWeights.push_back(std::vector<double>(masterWeights.begin() + n * numOfInputs, masterWeights.begin() + (n + 1) * numOfInputs));
+				}
+
+				NeuronLayer layer(numOfNeurons, layerWeights, std::vector<double>(biases.begin(), biases.end()));
+				layer.activationFunction = activationFunction;
+				layer.activationFunctionDerivative = activationFunctionDerivative;
+				return layer;
+			}
+		};
+
+		// Buffers of mse_fit_mixed_precision for up to numOfRows samples
+		template <typename StorageType>
+		struct MixedPrecisionWorkspace {
+			// One row-major matrix per layer, one row per sample
+			std::vector<std::vector<StorageType>> weightedSums;
+			std::vector<std::vector<StorageType>> activations;
+			std::vector<std::vector<StorageType>> deltas;
+			// Float copies of the inputs and deltas of every layer, converted once for the gradient accumulation
+			std::vector<std::vector<float>> layerInputs;
+			std::vector<std::vector<float>> layerDeltas;
+
+			MixedPrecisionWorkspace(std::vector<int> layerShape, int numOfInputs, int numOfRows) {
+				int numOfLayerInputs = numOfInputs;
+				for (unsigned int l = 0; l < layerShape.size(); l++) {
+					weightedSums.push_back(std::vector<StorageType>(numOfRows * layerShape[l]));
+					activations.push_back(std::vector<StorageType>(numOfRows * layerShape[l]));
+					deltas.push_back(std::vector<StorageType>(numOfRows * layerShape[l]));
+					layerInputs.push_back(std::vector<float>(numOfRows * numOfLayerInputs));
+					layerDeltas.push_back(std::vector<float>(numOfRows * layerShape[l]));
+					numOfLayerInputs = layerShape[l];
+				}
+			}
+		};
+
+		// Values of one micro-batch that did not fit in StorageType
+		struct MixedPrecisionStatus {
+			// A delta did not fit, which a smaller loss scale can fix
+			bool overflow = false;
+			// A weighted sum or activation did not fit, which loss scaling can not fix
+			bool forwardOverflow = false;
+			// A weighted sum or activation is NaN, so training has diverged
+			bool forwardNaN = false;
+		};
+
+		// Same passes as calculateDeltas with StorageType weights, activations and deltas and float sums, on rows firstRow to
+		// firstRow + numOfSamples - 1 of the workspace. Output deltas are multiplied by lossScale. Also fills the float copies
+		// the gradient is accumulated from. Returns the summed squared error of the samples
+		template <typename StorageType>
+		double calculateMixedPrecisionDeltas(const std::vector<MixedPrecisionLayer<StorageType>>& layers, const StorageType* inputs, const StorageType* expectedOutputs,
+			MixedPrecisionWorkspace<StorageType>& workspace, int numOfSamples, int firstRow, float lossScale, MixedPrecisionStatus& status) {
+			const int numOfLayers = layers.size();
+
+			// Forward pass
+			for (int l = 0; l < numOfLayers; l++) {
+				const MixedPrecisionLayer<StorageType>& layer = layers[l];
+				const StorageType* previous = (l == 0) ? inputs : &workspace.activations[l - 1][firstRow * layer.numOfInputs];
+
+				for (int s = 0; s < numOfSamples; s++) {
+					const StorageType* input = previous + s * layer.numOfInputs;
+					for (int n = 0; n < layer.numOfNeurons; n++) {
+						const StorageType* weights = &layer.weights[n * layer.numOfInputs];
+						float sum = layer.biases[n];
+						for (int i = 0; i < layer.numOfInputs; i++) {
+							sum += (float)weights[i] * (float)input[i];
+						}
+						StorageType weightedSum = StorageType(sum);
+						StorageType activation = StorageType((float)layer.activationFunction(sum));
+						if (std::isnan((float)weightedSum) || std::isnan((float)activation)) status.forwardNaN = true;
+						else if (!std::isfinite((float)weightedSum) || !std::isfinite((float)activation)) status.forwardOverflow = true;
+
+						int j = (firstRow + s) * layer.numOfNeurons + n;
+						workspace.weightedSums[l][j] = weightedSum;
+						workspace.activations[l][j] = activation;
+					}
+				}
+			}
+
+			// Output layer deltas for the MSE cost function
+			double cost = 0;
+			const MixedPrecisionLayer<StorageType>& outputLayer = layers.back();
+			for (int k = 0; k < numOfSamples * outputLayer.numOfNeurons; k++) {
+				int j = firstRow * outputLayer.numOfNeurons + k;
+				float difference = (float)workspace.activations.back()[j] - (float)expectedOutputs[k];
+				cost += difference * difference;
+
+				float delta = (float)outputLayer.activationFunctionDerivative((float)workspace.weightedSums.back()[j]) * 2 * difference * lossScale;
+				workspace.deltas.back()[j] = StorageType(delta);
+				if (!std::isfinite((float)workspace.deltas.back()[j])) status.overflow = true;
+			}
+
+			// Backward pass, summing in float
+			std::vector<float> sums;
+			for (int l = numOfLayers - 2; l >= 0; l--) {
+				const MixedPrecisionLayer<StorageType>& layer = layers[l];
+				const MixedPrecisionLayer<StorageType>& next = layers[l + 1];
+				sums.resize(layer.numOfNeurons);
+
+				for (int s = firstRow; s < firstRow + numOfSamples; s++) {
+					std::fill(sums.begin(), sums.end(), 0.0f);
+
+					for (int p = 0; p < next.numOfNeurons; p++) {
+						float nextDelta = workspace.deltas[l + 1][s * next.numOfNeurons + p];
+						if (nextDelta == 0) continue;
+
+						const StorageType* weights = &next.weights[p * next.numOfInputs];
+						for (int n = 0; n < layer.numOfNeurons; n++) {
+							sums[n] += (float)weights[n] * nextDelta;
+						}
+					}
+					for (int n = 0; n < layer.numOfNeurons; n++) {
+						int j = s * layer.numOfNeurons + n;
+						workspace.deltas[l][j] = StorageType(sums[n] * (float)layer.activationFunctionDerivative((float)workspace.weightedSums[l][j]));
+						if (!std::isfinite((float)workspace.deltas[l][j])) status.overflow = true;
+					}
+				}
+			}
+
+			// Convert each input and delta once instead of once per neuron of the gradient accumulation
+			for (int l = 0; l < numOfLayers; l++) {
+				const int numOfInputs = layers[l].numOfInputs;
+				const int numOfNeurons = layers[l].numOfNeurons;
+				const StorageType* previous = (l == 0) ? inputs : &workspace.activations[l - 1][firstRow * numOfInputs];
+
+				float* layerInputs = &workspace.layerInputs[l][firstRow * numOfInputs];
+				for (int i = 0; i < numOfSamples * numOfInputs; i++) layerInputs[i] = previous[i];
+				float* layerDeltas = &workspace.layerDeltas[l][firstRow * numOfNeurons];
+				const StorageType* deltas = &workspace.deltas[l][firstRow * numOfNeurons];
+				for (int i = 0; i < numOfSamples * numOfNeurons; i++) layerDeltas[i] = deltas[i];
+			}
+
+			return cost;
+		}
+
+		// Parameters, round buffers, float gradient and loss scale of mse_fit_mixed_precision. Used by trainInRounds like
+		// AccumulatedTrainer
+		template <typename StorageType>
+		class MixedPrecisionTrainer {
+		private:
+			std::vector<MixedPrecisionLayer<StorageType>> layers;
+			runtime::ThreadPool& pool;
+			BasicGradientAccumulator<float> gradient;
+			MixedPrecisionWorkspace<StorageType> workspace;
+			std::vector<StorageType> roundInputs;
+			std::vector<StorageType> roundExpectedOutputs;
+			int numOfInputs;
+			int numOfOutputs;
+			double learningRate;
+
+			float lossScale;
+			float minLossScale;
+			int lossScaleGrowthInterval;
+			int updatesSinceOverflow = 0;
+			// Set by any micro-batch of the current mini-batch whose deltas overflowed
+			std::atomic<bool> overflow{ false };
+
+		public:
+			MixedPrecisionTrainer(NeuralNetwork& model, runtime::ThreadPool& threadPool, int samplesPerRound, double learningRate, MixedPrecisionSettings settings)
+				: pool(threadPool), gradient(model.getLayerShape(), model.getNumOfInputs()), workspace(model.getLayerShape(), model.getNumOfInputs(), samplesPerRound) {
+				std::vector<NeuronLayer> modelLayers = model.getLayers();
+				for (unsigned int l = 0; l < modelLayers.size(); l++) {
+					layers.push_back(MixedPrecisionLayer<StorageType>(modelLayers[l]));
+				}
+				this->numOfInputs = model.getNumOfInputs();
+				this->numOfOutputs = layers.back().numOfNeurons;
+				this->learningRate = learningRate;
+				roundInputs.resize(samplesPerRound * numOfInputs);
+				roundExpectedOutputs.resize(samplesPerRound * numOfOutputs);
+
+				this->lossScale = settings.initialLossScale;
+				this->minLossScale = settings.minLossScale;
+				this->lossScaleGrowthInterval = (settings.lossScaleGrowthInterval >= 0) ? settings.lossScaleGrowthInterval
+					: ((settings.initialLossScale != 1) ? 2000 : 0);
+			}
+			void loadSample(int row, const std::vector<double>& inputs, const std::vector<double>& expectedOutputs) {
+				for (int i = 0; i < numOfInputs; i++) roundInputs[row * numOfInputs + i] = StorageType((float)inputs[i]);
+				for (int o = 0; o < numOfOutputs; o++) roundExpectedOutputs[row * numOfOutputs + o] = StorageType((float)expectedOutputs[o]);
+			}
+			// Throws if a weighted sum or activation does not fit in StorageType, since no loss scale can fix that
+			double runMicroBatch(int firstRow, int numOfSamples) {
+				MixedPrecisionStatus status;
+				double cost = calculateMixedPrecisionDeltas(layers, &roundInputs[firstRow * numOfInputs], &roundExpectedOutputs[firstRow * numOfOutputs], workspace,
+					numOfSamples, firstRow, lossScale, status);
+
+				if (status.forwardNaN) {
+					throw std::runtime_error("Training diverged: weighted sums or activations are NaN. Use a smaller learning rate");
+				}
+				if (status.forwardOverflow) {
+					if (std::is_same<StorageType, precision::float16>::value) {
+						throw std::runtime_error("Weighted sums or activations are too large for float16. Use bfloat16 or smaller weights and inputs");
+					}
+					throw std::runtime_error("Weighted sums or activations are too large for float. Use a smaller learning rate or smaller weights and inputs");
+				}
+				if (status.overflow) overflow = true;
+				return cost;
+			}
+			void accumulate(int numOfSamples) {
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					int grainSize = getNeuronGrainSize((long long)layers[l].numOfInputs * numOfSamples);
+					pool.parallelFor(0, layers[l].numOfNeurons, grainSize, [&](int firstNeuron, int lastNeuron) {
+						gradient.accumulateLayer(l, workspace.layerDeltas[l].data(), workspace.layerInputs[l].data(), numOfSamples, firstNeuron, lastNeuron);
+					});
+				}
+			}
+			std::string getStatus() const {
+				std::ostringstream status;
+				status << "\tLoss scale: " << lossScale << ((overflow) ? " (overflow, batch skipped)" : "");
+				return status.str();
+			}
+			// Skips the mini-batch and halves the loss scale if a delta overflowed. Otherwise updates the master weights with the
+			// unscaled average gradient and rounds them into the storage copy
+			void update(int samplesPerBatch) {
+				if (overflow) {
+					gradient.reset();
+					overflow = false;
+					lossScale /= 2;
+					updatesSinceOverflow = 0;
+					if (lossScale < minLossScale) {
+						throw std::runtime_error("Loss scale fell below the minimum: deltas keep overflowing the storage type");
+					}
+					return;
+				}
+
+				const float step = (float)(learningRate / ((double)samplesPerBatch * lossScale));
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					MixedPrecisionLayer<StorageType>& layer = layers[l];
+					const std::vector<float>& weightGradient = gradient.getWeightGradient(l);
+					const std::vector<float>& biasGradient = gradient.getBiasGradient(l);
+
+					pool.parallelFor(0, layer.numOfNeurons, getNeuronGrainSize(layer.numOfInputs), [&](int firstNeuron, int lastNeuron) {
+						for (int i = firstNeuron * layer.numOfInputs; i < lastNeuron * layer.numOfInputs; i++) {
+							layer.masterWeights[i] -= step * weightGradient[i];
+							layer.weights[i] = StorageType(layer.masterWeights[i]);
+						}
+						for (int n = firstNeuron; n < lastNeuron; n++) {
+							layer.biases[n] -= step * biasGradient[n];
+						}
+						gradient.resetNeurons(l, firstNeuron, lastNeuron);
+					});
+				}
+
+				if (lossScaleGrowthInterval > 0 && ++updatesSinceOverflow >= lossScaleGrowthInterval) {
+					lossScale *= 2;
+					updatesSinceOverflow = 0;
+				}
+			}
+			int getNumOfInputs() const {
+				return numOfInputs;
+			}
+			int getNumOfOutputs() const {
+				return numOfOutputs;
+			}
+			NeuralNetwork toNeuralNetwork() const {
+				std::vector<NeuronLayer> trainedLayers;
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					trainedLayers.push_back(layers[l].toNeuronLayer());
+				}
+				return NeuralNetwork(trainedLayers, numOfInputs);
+			}
+		};
+
+		// Same training as mse_fit_accumulated, but weights, activations and deltas are stored as StorageType (bfloat16 on
+		// default, or precision::float16) and all sums are done in float. A float master copy of the weights receives the
+		// updates. StorageType = float trains fully in single precision. Validation works as in mse_fit_accumulated
+		template <typename StorageType = precision::bfloat16>
+		NeuralNetwork mse_fit_mixed_precision(NeuralNetwork& model, const int numOfMiniBatches, const int numOfTrainingSamples, std::vector<double>(*inputTrainingDataGen)(int dataIndex),
+			std::vector<double>(*expectedOutputDataGen)(int dataIndex), const int epochs = 11, const double learningRate = 0.1, const int microBatchSize = 32, const bool showUpdates = true,
+			const MixedPrecisionSettings settings = MixedPrecisionSettings(), const ValidationSettings* validation = nullptr) {
+
+			if (microBatchSize <= 0) {
+				throw std::runtime_error("Micro-batch size must be positive");
+			}
+
+			runtime::ThreadPool& pool = runtime::getDefaultPool();
+			const int samplesPerRound = std::max(1, pool.getNumOfThreads()) * microBatchSize;
+			MixedPrecisionTrainer<StorageType> trainer(model, pool, samplesPerRound, learningRate, settings);
+
+			return trainInRounds(trainer, pool, samplesPerRound, numOfMiniBatches, numOfTrainingSamples, inputTrainingDataGen, expectedOutputDataGen, epochs,
+				microBatchSize, showUpdates, validation);
+		}
+	}
+}
@@ -31,6 +31,23 @@ namespace deeplframework {
                 labelReader.close();
             }
 
+            // Number of labels in the labels file, as stored in its header. The t10k test files hold 10000 items
+            int getNumOfItems() {
+                if (labelReader.is_open()) {
+                    unsigned char count[4] = {};
+
+                    // The count is stored big-endian after the 4 byte magic number
+                    labelReader.seekg(4);
+                    labelReader.read(reinterpret_cast<char*>(count), 4);
+
+                    return (count[0] << 24) | (count[1] << 16) | (count[2] << 8) | count[3];
+                }
+                else {
+                    throw std::runtime_error("Object is not open");
+                }
+                return 0;
+            }
+
             // LabelsFile must be opened in binary format. Function returns -1 if there is a problem.
             // Function does not close ifstream connection to file.
             std::vector<double> getLabelOutput(int labelId) {
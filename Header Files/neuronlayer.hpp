@@ -2,6 +2,7 @@
 #include <vector>
 #include <stdexcept>
 #include "activationfunctions.hpp"
+#include "threadpool.hpp"
 
 namespace deeplframework {
 	class NeuronLayer {
@@ -15,6 +16,19 @@ namespace deeplframework {
 		mutable std::vector<double> lastLayerOutputBA;
 
 	public:
+		// Layers with fewer weights are too small to be worth splitting between threads
+		static const int PARALLEL_MIN_WEIGHTS = 1 << 16;
+
+		// Bias plus the dot product of one row of weights with the inputs. Every dense forward pass uses this, so running,
+		// training and evaluating a network give the same sums
+		static double calculateWeightedSum(const double* rowWeights, const double* inputs, int numberOfInputs, double bias) {
+			double sum = bias;
+			for (int j = 0; j < numberOfInputs; j++) {
+				sum += rowWeights[j] * inputs[j];
+			}
+			return sum;
+		}
+
 		// On default, a rectified linear activation function is used (ReLU)
 		double(*activationFunction)(double) = activationFunctions::ReLU;
 		double(*activationFunctionDerivative)(double) = activationFunctionDerivatives::ReLU;
@@ -74,23 +88,30 @@ namespace deeplframework {
 			return (beforeActivationFunction) ? lastLayerOutputBA : lastLayerOutput;
 		}
 		// Calculate dot product of weights matrix and neuronInputs vector + biases vector. NeuronInputs vector length needs to
-		// be equal to the number of weights per neuron
+		// be equal to the number of weights per neuron. Large layers split their rows between the runtime thread pool
 		std::vector<double> propogateCalculations(std::vector<double> neuronInputs, bool recordActivations = false) {
 			if (neuronInputs.size() != weights[0].size()) {
 				throw std::runtime_error("Neuron outputs vector is invalid");
 			}
 
-			if (recordActivations) lastLayerOutputBA = {};
+			if (recordActivations) lastLayerOutputBA.resize(weights.size());
 
-			std::vector<double> output;
-			for (unsigned int i = 0; i < weights.size(); i++) {
-				double sum = biases[i];
-				for (unsigned int j = 0; j < neuronInputs.size(); j++) {
-					sum += weights[i][j] * neuronInputs[j];
+			std::vector<double> output(weights.size());
+			auto calculateRows = [&](int firstRow, int lastRow) {
+				for (int i = firstRow; i < lastRow; i++) {
+					double sum = calculateWeightedSum(weights[i].data(), neuronInputs.data(), numOfInputs, biases[i]);
+					if (recordActivations) lastLayerOutputBA[i] = sum;
+					output[i] = activationFunction(sum);
 				}
-				if (recordActivations) lastLayerOutputBA.push_back(sum);
-				output.push_back(activationFunction(sum));
+			};
+
+			if ((long long)numOfNeurons * numOfInputs >= PARALLEL_MIN_WEIGHTS) {
+				runtime::getDefaultPool().parallelFor(0, numOfNeurons, 0, calculateRows);
+			}
+			else {
+				calculateRows(0, numOfNeurons);
 			}
+
 			if (recordActivations) lastLayerOutput = output;
 			return output;
 		}
@@ -0,0 +1,160 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+
+#include "neuronnetwork.hpp"
+#include "sparseneuronnetwork.hpp"
+#include "evaluation.hpp"
+
+namespace deeplframework {
+	namespace pruning {
+		struct SparsityReportEntry {
+			double targetSparsity;
+			// Fraction of weights that are zero after pruning
+			double sparsity;
+			double accuracy;
+			int numOfStoredBlocks;
+		};
+
+		// Returns the threshold below which the given fraction of the scores fall. Scores equal to the threshold are kept
+		double getPruningThreshold(std::vector<double> scores, double sparsity) {
+			if (sparsity < 0 || sparsity > 1) {
+				throw std::runtime_error("Sparsity must be between 0 and 1");
+			}
+			int numToPrune = (int)(sparsity * scores.size());
+			if (numToPrune == 0) return 0;
+			if (numToPrune >= (int)scores.size()) return INFINITY;
+
+			std::nth_element(scores.begin(), scores.begin() + numToPrune, scores.end());
+			return scores[numToPrune];
+		}
+
+		// Sets the smallest weights of every layer to zero, so that roughly the given fraction of each layer's weights is zero
+		NeuralNetwork pruneByMagnitude(NeuralNetwork model, double sparsity) {
+			std::vector<NeuronLayer> layers = model.getLayers();
+
+			for (unsigned int l = 0; l < layers.size(); l++) {
+				std::vector<std::vector<double>> weights = layers[l].getWeights();
+
+				std::vector<double> scores;
+				for (unsigned int n = 0; n < weights.size(); n++) {
+					for (unsigned int wi = 0; wi < weights[n].size(); wi++) {
+						scores.push_back(std::abs(weights[n][wi]));
+					}
+				}
+				double threshold = getPruningThreshold(scores, sparsity);
+
+				for (unsigned int n = 0; n < weights.size(); n++) {
+					for (unsigned int wi = 0; wi < weights[n].size(); wi++) {
+						if (std::abs(weights[n][wi]) < threshold) model.setLayerWeight(l, n, wi, 0);
+					}
+				}
+			}
+			return model;
+		}
+
+		// Structured pruning. Weights are grouped into the same blocks SparseNeuronLayer stores, and the blocks with the
+		// smallest mean absolute weight are set to zero until the given fraction of each layer's weights is zero. The shorter
+		// last block of a row counts for the weights it holds, so sparsity is a fraction of weights, not of blocks. Gives faster
+		// sparse layers than pruneByMagnitude at the same sparsity
+		NeuralNetwork pruneByBlockMagnitude(NeuralNetwork model, double sparsity) {
+			if (sparsity < 0 || sparsity > 1) {
+				throw std::runtime_error("Sparsity must be between 0 and 1");
+			}
+			std::vector<NeuronLayer> layers = model.getLayers();
+
+			for (unsigned int l = 0; l < layers.size(); l++) {
+				std::vector<std::vector<double>> weights = layers[l].getWeights();
+				int numOfInputs = layers[l].getNumOfInputs();
+
+				// Neuron, first column and mean absolute weight of every block
+				struct Block {
+					int neuron;
+					int column;
+					double score;
+				};
+				std::vector<Block> blocks;
+				for (unsigned int n = 0; n < weights.size(); n++) {
+					for (int column = 0; column < numOfInputs; column += BLOCK_SIZE) {
+						double score = 0;
+						int blockWidth = std::min(BLOCK_SIZE, numOfInputs - column);
+						for (int k = 0; k < blockWidth; k++) {
+							score += std::abs(weights[n][column + k]);
+						}
+						blocks.push_back({ (int)n, column, score / blockWidth });
+					}
+				}
+				std::stable_sort(blocks.begin(), blocks.end(), [](const Block& a, const Block& b) { return a.score < b.score; });
+
+				long long numToPrune = (long long)(sparsity * weights.size() * numOfInputs);
+				long long numPruned = 0;
+				for (unsigned int b = 0; b < blocks.size() && numPruned < numToPrune; b++) {
+					int blockWidth = std::min(BLOCK_SIZE, numOfInputs - blocks[b].column);
+					for (int k = 0; k < blockWidth; k++) {
+						model.setLayerWeight(l, blocks[b].neuron, blocks[b].column + k, 0);
+					}
+					numPruned += blockWidth;
+				}
+			}
+			return model;
+		}
+
+		// Fraction of samples where the largest output matches the largest expected output. Samples are run in batches of batchSize
+		double measureAccuracy(const SparseNeuralNetwork& network, const int firstSample, const int numOfSamples, std::vector<double>(*inputDataGen)(int dataIndex),
+			std::vector<double>(*expectedOutputDataGen)(int dataIndex), const int batchSize = 64) {
+			if (batchSize <= 0) {
+				throw std::runtime_error("Batch size must be positive");
+			}
+			if (numOfSamples <= 0) return 0;
+
+			int numCorrect = 0;
+			for (int first = firstSample; first < firstSample + numOfSamples; first += batchSize) {
+				int last = std::min(first + batchSize, firstSample + numOfSamples);
+
+				std::vector<std::vector<double>> inputs;
+				for (int sample = first; sample < last; sample++) inputs.push_back(inputDataGen(sample));
+
+				std::vector<std::vector<double>> outputs = network.runBatch(inputs);
+
+				for (int sample = first; sample < last; sample++) {
+					std::vector<double>& output = outputs[sample - first];
+					std::vector<double> expected = expectedOutputDataGen(sample);
+					if (evaluation::getPredictedClass(output.data(), output.size()) == evaluation::getPredictedClass(expected.data(), expected.size())) {
+						numCorrect++;
+					}
+				}
+			}
+			return (double)numCorrect / numOfSamples;
+		}
+
+		// Prunes the model to each of the given sparsities and measures the accuracy of the resulting sparse network on the
+		// samples firstSample to firstSample + numOfSamples - 1
+		std::vector<SparsityReportEntry> sparsityReport(NeuralNetwork& model, std::vector<double> sparsities, const int firstSample, const int numOfSamples,
+			std::vector<double>(*inputDataGen)(int dataIndex), std::vector<double>(*expectedOutputDataGen)(int dataIndex), const bool blockPruning = true,
+			const bool showUpdates = true) {
+			std::vector<SparsityReportEntry> report;
+
+			for (double target : sparsities) {
+				NeuralNetwork pruned = (blockPruning) ? pruneByBlockMagnitude(model, target) : pruneByMagnitude(model, target);
+				SparseNeuralNetwork sparse(pruned);
+
+				SparsityReportEntry entry;
+				entry.targetSparsity = target;
+				entry.sparsity = sparse.getSparsity();
+				entry.accuracy = measureAccuracy(sparse, firstSample, numOfSamples, inputDataGen, expectedOutputDataGen);
+				entry.numOfStoredBlocks = 0;
+				std::vector<SparseNeuronLayer> layers = sparse.getLayers();
+				for (unsigned int l = 0; l < layers.size(); l++) entry.numOfStoredBlocks += layers[l].getNumOfStoredBlocks();
+
+				if (showUpdates) {
+					std::cout << "Sparsity: " << entry.sparsity << "\tAccuracy: " << entry.accuracy << "\tStored blocks: " << entry.numOfStoredBlocks << "\n";
+				}
+				report.push_back(entry);
+			}
+			return report;
+		}
+	}
+}
@@ -0,0 +1,229 @@
+#pragma once
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "activationfunctions.hpp"
+#include "neuronlayer.hpp"
+
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+
+namespace deeplframework {
+	namespace pruning {
+		// Number of consecutive weights in a row that are stored together. 4 doubles fill one AVX register
+		const int BLOCK_SIZE = 4;
+		// Number of samples that share each weight block load in propogateBatch
+		const int SAMPLE_TILE = 4;
+
+		// Layer that only stores the non-zero blocks of its weights matrix (block compressed sparse rows). Every row
+		// is split into aligned blocks of BLOCK_SIZE inputs, and a block is stored if any of its weights is non-zero
+		class SparseNeuronLayer {
+		private:
+			int numOfNeurons;
+			int numOfInputs;
+			std::vector<double> biases;
+			// Blocks of neuron n are at indexes rowStart[n] to rowStart[n + 1] - 1
+			std::vector<int> rowStart;
+			// Index of the first input of each block
+			std::vector<int> blockColumns;
+			// BLOCK_SIZE weights per block
+			std::vector<double> blockValues;
+
+			// Inputs are padded with zeros so the last block of a row can always be read in full
+			int getPaddedNumOfInputs() const {
+				return ((numOfInputs + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+			}
+
+			// Dot product of the stored blocks from blockBegin to blockEnd and up to SAMPLE_TILE padded input vectors
+			void blockDot(int blockBegin, int blockEnd, const double* const* inputs, int numOfSamples, double* sums) const {
+#ifdef __AVX__
+				__m256d acc[SAMPLE_TILE];
+				for (int s = 0; s < numOfSamples; s++) acc[s] = _mm256_setzero_pd();
+
+				for (int b = blockBegin; b < blockEnd; b++) {
+					__m256d w = _mm256_loadu_pd(&blockValues[b * BLOCK_SIZE]);
+					int column = blockColumns[b];
+					for (int s = 0; s < numOfSamples; s++) {
+						acc[s] = _mm256_add_pd(acc[s], _mm256_mul_pd(w, _mm256_loadu_pd(inputs[s] + column)));
+					}
+				}
+
+				for (int s = 0; s < numOfSamples; s++) {
+					double lanes[BLOCK_SIZE];
+					_mm256_storeu_pd(lanes, acc[s]);
+					sums[s] = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+				}
+#else
+				double acc[SAMPLE_TILE][BLOCK_SIZE] = {};
+
+				for (int b = blockBegin; b < blockEnd; b++) {
+					const double* w = &blockValues[b * BLOCK_SIZE];
+					int column = blockColumns[b];
+					for (int s = 0; s < numOfSamples; s++) {
+						for (int k = 0; k < BLOCK_SIZE; k++) {
+							acc[s][k] += w[k] * inputs[s][column + k];
+						}
+					}
+				}
+
+				for (int s = 0; s < numOfSamples; s++) {
+					sums[s] = (acc[s][0] + acc[s][1]) + (acc[s][2] + acc[s][3]);
+				}
+#endif
+			}
+
+		public:
+			double(*activationFunction)(double) = activationFunctions::ReLU;
+			double(*activationFunctionDerivative)(double) = activationFunctionDerivatives::ReLU;
+
+			// Weights that are exactly zero in the dense layer are dropped. Activation functions are copied
+			SparseNeuronLayer(NeuronLayer denseLayer) {
+				this->numOfNeurons = denseLayer.getNumOfNeurons();
+				this->numOfInputs = denseLayer.getNumOfInputs();
+				this->biases = denseLayer.getBiases();
+				this->activationFunction = denseLayer.activationFunction;
+				this->activationFunctionDerivative = denseLayer.activationFunctionDerivative;
+
+				std::vector<std::vector<double>> weights = denseLayer.getWeights();
+
+				rowStart.push_back(0);
+				for (int n = 0; n < numOfNeurons; n++) {
+					for (int column = 0; column < numOfInputs; column += BLOCK_SIZE) {
+						bool isZero = true;
+						for (int k = 0; k < BLOCK_SIZE && column + k < numOfInputs; k++) {
+							if (weights[n][column + k] != 0) isZero = false;
+						}
+						if (isZero) continue;
+
+						blockColumns.push_back(column);
+						for (int k = 0; k < BLOCK_SIZE; k++) {
+							blockValues.push_back((column + k < numOfInputs) ? weights[n][column + k] : 0);
+						}
+					}
+					rowStart.push_back(blockColumns.size());
+				}
+			}
+			// Layer from already blocked data, as written by SparseNeuralNetwork::WriteToBinaryFile
+			SparseNeuronLayer(unsigned int numberOfNeurons, unsigned int numberOfInputs, std::vector<double> neuronBiases, std::vector<int> blockRowStart,
+				std::vector<int> blockInputIndexes, std::vector<double> blockWeights) {
+				if (numberOfNeurons == 0 || numberOfInputs == 0) {
+					throw std::runtime_error("More weights and/or neurons are required for a layer");
+				} if (neuronBiases.size() != numberOfNeurons) {
+					throw std::runtime_error("Biases list is invalid");
+				} if (blockRowStart.size() != numberOfNeurons + 1 || blockRowStart[0] != 0 || blockRowStart[numberOfNeurons] != (int)blockInputIndexes.size()
+					|| blockWeights.size() != blockInputIndexes.size() * BLOCK_SIZE) {
+					throw std::runtime_error("Sparse weights matrix is invalid");
+				}
+				for (unsigned int n = 0; n < numberOfNeurons; n++) {
+					if (blockRowStart[n] > blockRowStart[n + 1]) throw std::runtime_error("Sparse weights matrix is invalid");
+				}
+				for (unsigned int b = 0; b < blockInputIndexes.size(); b++) {
+					if (blockInputIndexes[b] < 0 || blockInputIndexes[b] % BLOCK_SIZE != 0 || blockInputIndexes[b] >= (int)numberOfInputs) {
+						throw std::runtime_error("Sparse weights matrix is invalid");
+					}
+				}
+
+				this->numOfNeurons = numberOfNeurons;
+				this->numOfInputs = numberOfInputs;
+				this->biases = neuronBiases;
+				this->rowStart = blockRowStart;
+				this->blockColumns = blockInputIndexes;
+				this->blockValues = blockWeights;
+			}
+			int getNumOfNeurons() {
+				return numOfNeurons;
+			}
+			int getNumOfInputs() {
+				return numOfInputs;
+			}
+			int getNumOfStoredBlocks() {
+				return blockColumns.size();
+			}
+			std::vector<double> getBiases() {
+				return biases;
+			}
+			std::vector<int> getRowStart() {
+				return rowStart;
+			}
+			std::vector<int> getBlockColumns() {
+				return blockColumns;
+			}
+			std::vector<double> getBlockValues() {
+				return blockValues;
+			}
+			// Fraction of the weights matrix that is zero
+			double getSparsity() {
+				int nonZero = 0;
+				for (unsigned int i = 0; i < blockValues.size(); i++) {
+					if (blockValues[i] != 0) nonZero++;
+				}
+				return 1.0 - (double)nonZero / ((double)numOfNeurons * numOfInputs);
+			}
+			// Expand back into a regular layer
+			NeuronLayer toDenseLayer() {
+				std::vector<std::vector<double>> weights(numOfNeurons, std::vector<double>(numOfInputs, 0));
+				for (int n = 0; n < numOfNeurons; n++) {
+					for (int b = rowStart[n]; b < rowStart[n + 1]; b++) {
+						for (int k = 0; k < BLOCK_SIZE && blockColumns[b] + k < numOfInputs; k++) {
+							weights[n][blockColumns[b] + k] = blockValues[b * BLOCK_SIZE + k];
+						}
+					}
+				}
+
+				NeuronLayer layer(numOfNeurons, weights, biases);
+				layer.activationFunction = activationFunction;
+				layer.activationFunctionDerivative = activationFunctionDerivative;
+				return layer;
+			}
+			// Sparse matrix-vector product. Matches NeuronLayer::propogateCalculations on the dense layer up to rounding
+			std::vector<double> propogateCalculations(const std::vector<double>& neuronInputs) const {
+				if ((int)neuronInputs.size() != numOfInputs) {
+					throw std::runtime_error("Neuron outputs vector is invalid");
+				}
+
+				std::vector<double> padded(neuronInputs);
+				padded.resize(getPaddedNumOfInputs(), 0);
+				const double* input = padded.data();
+
+				std::vector<double> output(numOfNeurons);
+				for (int n = 0; n < numOfNeurons; n++) {
+					double sum = 0;
+					blockDot(rowStart[n], rowStart[n + 1], &input, 1, &sum);
+					output[n] = activationFunction(biases[n] + sum);
+				}
+				return output;
+			}
+			// Sparse matrix-matrix product for a batch of inputs. Each weight block is loaded once for up to SAMPLE_TILE samples
+			std::vector<std::vector<double>> propogateBatch(const std::vector<std::vector<double>>& batchInputs) const {
+				const int paddedNumOfInputs = getPaddedNumOfInputs();
+
+				std::vector<double> padded(batchInputs.size() * paddedNumOfInputs, 0);
+				for (unsigned int s = 0; s < batchInputs.size(); s++) {
+					if ((int)batchInputs[s].size() != numOfInputs) {
+						throw std::runtime_error("Neuron outputs vector is invalid");
+					}
+					std::copy(batchInputs[s].begin(), batchInputs[s].end(), padded.begin() + s * paddedNumOfInputs);
+				}
+
+				std::vector<std::vector<double>> outputs(batchInputs.size(), std::vector<double>(numOfNeurons));
+				for (unsigned int first = 0; first < batchInputs.size(); first += SAMPLE_TILE) {
+					int tileSize = std::min<int>(SAMPLE_TILE, batchInputs.size() - first);
+
+					const double* inputs[SAMPLE_TILE];
+					for (int s = 0; s < tileSize; s++) inputs[s] = padded.data() + (first + s) * paddedNumOfInputs;
+
+					for (int n = 0; n < numOfNeurons; n++) {
+						double sums[SAMPLE_TILE];
+						blockDot(rowStart[n], rowStart[n + 1], inputs, tileSize, sums);
+						for (int s = 0; s < tileSize; s++) {
+							outputs[first + s][n] = activationFunction(biases[n] + sums[s]);
+						}
+					}
+				}
+				return outputs;
+			}
+		};
+	}
+}
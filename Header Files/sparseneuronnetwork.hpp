@@ -0,0 +1,170 @@
+#pragma once
+#include <vector>
+#include <fstream>
+
+#include "neuronnetwork.hpp"
+#include "sparseneuronlayer.hpp"
+
+namespace deeplframework {
+	namespace pruning {
+		// Inference-only network made of SparseNeuronLayers. Create it from a pruned NeuralNetwork
+		class SparseNeuralNetwork {
+		private:
+			std::vector<SparseNeuronLayer> layers;
+			unsigned int numInputs;
+
+		public:
+			// Empty network
+			SparseNeuralNetwork() {
+				this->layers = {};
+				this->numInputs = 0;
+			}
+			// Weights that are exactly zero in the dense network are not stored
+			SparseNeuralNetwork(NeuralNetwork network) {
+				std::vector<NeuronLayer> denseLayers = network.getLayers();
+				for (unsigned int l = 0; l < denseLayers.size(); l++) {
+					this->layers.push_back(SparseNeuronLayer(denseLayers[l]));
+				}
+				this->numInputs = network.getNumOfInputs();
+			}
+			SparseNeuralNetwork(std::vector<SparseNeuronLayer> networkLayers, unsigned int numberOfInputs) {
+				this->layers = networkLayers;
+				this->numInputs = numberOfInputs;
+			}
+
+			// Same as NeuralNetwork::setActivationFunction. Activation functions are not stored in binary files
+			void setActivationFunction(unsigned int layerIndex, double(*activationFunc)(double), double(*activationFuncDerivative)(double)) {
+				layers[layerIndex].activationFunction = activationFunc;
+				layers[layerIndex].activationFunctionDerivative = activationFuncDerivative;
+			}
+			void setActivationForAllLayers(double(*activationFunc)(double), double(*activationFuncDerivative)(double)) {
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					setActivationFunction(l, activationFunc, activationFuncDerivative);
+				}
+			}
+			int getNumOfInputs() {
+				return this->numInputs;
+			}
+			std::vector<SparseNeuronLayer> getLayers() {
+				return layers;
+			}
+			// Fraction of all weights in the network that are zero
+			double getSparsity() {
+				double zeros = 0;
+				double total = 0;
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					double layerSize = (double)layers[l].getNumOfNeurons() * layers[l].getNumOfInputs();
+					zeros += layers[l].getSparsity() * layerSize;
+					total += layerSize;
+				}
+				return (total == 0) ? 0 : zeros / total;
+			}
+			NeuralNetwork toDenseNetwork() {
+				std::vector<NeuronLayer> denseLayers;
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					denseLayers.push_back(layers[l].toDenseLayer());
+				}
+				return NeuralNetwork(denseLayers, numInputs);
+			}
+			std::vector<double> run(const std::vector<double>& inputs) const {
+				std::vector<double> layerInputs = inputs;
+				for (unsigned int i = 0; i < layers.size(); i++) {
+					layerInputs = layers[i].propogateCalculations(layerInputs);
+				}
+				return layerInputs;
+			}
+			// Runs several inputs at once, which is faster than calling run for each input
+			std::vector<std::vector<double>> runBatch(const std::vector<std::vector<double>>& batchInputs) const {
+				std::vector<std::vector<double>> layerInputs = batchInputs;
+				for (unsigned int i = 0; i < layers.size(); i++) {
+					layerInputs = layers[i].propogateBatch(layerInputs);
+				}
+				return layerInputs;
+			}
+
+			// Layout per layer: number of neurons, number of inputs and number of stored blocks (4 bytes each), followed
+			// by the biases, the row start indexes, the first input index of every block and the weights of every block
+			static bool WriteToBinaryFile(SparseNeuralNetwork network, const char* path) {
+				std::ofstream os;
+				os.open(path, std::ios::trunc | std::ios::binary);
+
+				bool success = false;
+
+				if (os.is_open()) {
+					std::vector<SparseNeuronLayer> layers = network.getLayers();
+					int numOfLayers = layers.size();
+
+					os.write((char*)&numOfLayers, 4);
+
+					for (unsigned int l = 0; l < layers.size(); l++) {
+						int numOfNeurons = layers[l].getNumOfNeurons();
+						int numOfInputs = layers[l].getNumOfInputs();
+						int numOfBlocks = layers[l].getNumOfStoredBlocks();
+						os.write((char*)&numOfNeurons, 4);
+						os.write((char*)&numOfInputs, 4);
+						os.write((char*)&numOfBlocks, 4);
+
+						std::vector<double> biases = layers[l].getBiases();
+						std::vector<int> rowStart = layers[l].getRowStart();
+						std::vector<int> blockColumns = layers[l].getBlockColumns();
+						std::vector<double> blockValues = layers[l].getBlockValues();
+
+						os.write((char*)biases.data(), biases.size() * sizeof(double));
+						os.write((char*)rowStart.data(), rowStart.size() * sizeof(int));
+						os.write((char*)blockColumns.data(), blockColumns.size() * sizeof(int));
+						os.write((char*)blockValues.data(), blockValues.size() * sizeof(double));
+					}
+					success = os.good();
+				}
+				os.close();
+				return success;
+			}
+
+			static SparseNeuralNetwork ReadBinaryFile(const char* path) {
+				std::ifstream is;
+				is.open(path, std::ios::binary);
+
+				if (is.is_open()) {
+					std::vector<SparseNeuronLayer> networkLayers;
+
+					int numOfLayers = 0;
+					int numOfNetworkInputs = 0;
+
+					is.read((char*)&numOfLayers, 4);
+
+					for (int l = 0; l < numOfLayers; l++) {
+						int numOfNeurons = 0;
+						int numOfInputs = 0;
+						int numOfBlocks = 0;
+
+						is.read((char*)&numOfNeurons, 4);
+						is.read((char*)&numOfInputs, 4);
+						is.read((char*)&numOfBlocks, 4);
+
+						if (!is || numOfNeurons <= 0 || numOfInputs <= 0 || numOfBlocks < 0) {
+							throw std::runtime_error("Sparse network file is invalid");
+						}
+						if (l == 0) numOfNetworkInputs = numOfInputs;
+
+						std::vector<double> biases(numOfNeurons);
+						std::vector<int> rowStart(numOfNeurons + 1);
+						std::vector<int> blockColumns(numOfBlocks);
+						std::vector<double> blockValues(numOfBlocks * BLOCK_SIZE);
+
+						is.read((char*)biases.data(), biases.size() * sizeof(double));
+						is.read((char*)rowStart.data(), rowStart.size() * sizeof(int));
+						is.read((char*)blockColumns.data(), blockColumns.size() * sizeof(int));
+						is.read((char*)blockValues.data(), blockValues.size() * sizeof(double));
+
+						if (!is) throw std::runtime_error("Sparse network file is invalid");
+
+						networkLayers.push_back(SparseNeuronLayer(numOfNeurons, numOfInputs, biases, rowStart, blockColumns, blockValues));
+					}
+
+					return SparseNeuralNetwork(networkLayers, numOfNetworkInputs);
+				}
+				return SparseNeuralNetwork();
+			}
+		};
+	}
+}
@@ -0,0 +1,384 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace deeplframework {
+	namespace runtime {
+		struct RuntimeSettings {
+			// 0 uses one worker per CPU the process is allowed to run on
+			unsigned int numOfThreads = 0;
+			// Pin each worker to one CPU. Only supported on Linux, ignored elsewhere
+			bool pinThreads = true;
+			// CPU for worker i is cpus[i % cpus.size()]. If empty, the allowed CPUs are used grouped by NUMA node, so
+			// neighbouring workers share a node
+			std::vector<int> cpus;
+		};
+
+		// Returns the NUMA node of every CPU, read from /sys. All CPUs are on node 0 if the information is missing
+		std::vector<int> getCpuNodes(int numOfCpus) {
+			std::vector<int> nodes(numOfCpus, 0);
+			for (int node = 0; node < 64; node++) {
+				std::ifstream is("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				if (!is.is_open()) continue;
+
+				// Format is a comma separated list of ranges, e.g. 0-7,16-23
+				std::string range;
+				while (std::getline(is, range, ',')) {
+					int first = 0, last = 0;
+					char dash = 0;
+					std::istringstream rs(range);
+					if (!(rs >> first)) continue;
+					if (!(rs >> dash >> last)) last = first;
+					for (int cpu = first; cpu <= last && cpu < numOfCpus; cpu++) nodes[cpu] = node;
+				}
+			}
+			return nodes;
+		}
+
+		// CPUs the process is allowed to run on, grouped by NUMA node
+		std::vector<int> getAllowedCpus() {
+			std::vector<int> cpus;
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+				for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+					if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+				}
+			}
+#endif
+			if (cpus.empty()) {
+				for (unsigned int cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); cpu++) cpus.push_back(cpu);
+			}
+
+			std::vector<int> nodes = getCpuNodes(cpus.back() + 1);
+			std::stable_sort(cpus.begin(), cpus.end(), [&nodes](int a, int b) { return nodes[a] < nodes[b]; });
+			return cpus;
+		}
+
+		// Work-stealing thread pool. Every worker owns a task queue: it takes its own newest tasks first and steals the
+		// oldest tasks of other workers when its queue is empty. Tasks may start more parallel work from inside the pool
+		class ThreadPool {
+		private:
+			struct WorkerQueue {
+				std::mutex mutex;
+				std::deque<std::function<void()>> tasks;
+				// Tasks that only this worker may run, see runOnEachWorker
+				std::deque<std::function<void()>> pinnedTasks;
+				std::atomic<int> numOfPinnedTasks{ 0 };
+			};
+
+			// Completion state of one parallelFor or runOnEachWorker call
+			struct TaskGroup {
+				std::atomic<int> remaining{ 0 };
+				std::mutex mutex;
+				std::condition_variable done;
+				std::exception_ptr error;
+
+				// Decremented under the mutex, so the waiting thread can not destroy the group while it is still in use here
+				void finish() {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (--remaining == 0) done.notify_all();
+				}
+			};
+
+			std::vector<std::thread> workers;
+			std::vector<std::unique_ptr<WorkerQueue>> queues;
+			std::vector<int> workerCpus;
+
+			std::mutex sleepMutex;
+			std::condition_variable wakeUp;
+			std::atomic<int> numOfQueuedTasks{ 0 };
+			bool stopping = false;
+
+			static ThreadPool*& currentPool() {
+				static thread_local ThreadPool* pool = nullptr;
+				return pool;
+			}
+			static int& currentWorker() {
+				static thread_local int index = -1;
+				return index;
+			}
+
+			void pinCurrentThread(int cpu) {
+#ifdef __linux__
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+			}
+
+			bool tryGetTask(int worker, std::function<void()>& task) {
+				WorkerQueue& own = *queues[worker];
+				if (own.numOfPinnedTasks > 0) {
+					std::lock_guard<std::mutex> lock(own.mutex);
+					if (!own.pinnedTasks.empty()) {
+						task = std::move(own.pinnedTasks.front());
+						own.pinnedTasks.pop_front();
+						own.numOfPinnedTasks--;
+						return true;
+					}
+				}
+				if (numOfQueuedTasks == 0) return false;
+
+				// Own tasks newest first, then steal from the other workers oldest first
+				for (unsigned int i = 0; i < queues.size(); i++) {
+					WorkerQueue& queue = *queues[(worker + i) % queues.size()];
+					std::lock_guard<std::mutex> lock(queue.mutex);
+					if (queue.tasks.empty()) continue;
+
+					if (i == 0) {
+						task = std::move(queue.tasks.back());
+						queue.tasks.pop_back();
+					}
+					else {
+						task = std::move(queue.tasks.front());
+						queue.tasks.pop_front();
+					}
+					numOfQueuedTasks--;
+					return true;
+				}
+				return false;
+			}
+
+			void workerLoop(int index) {
+				currentPool() = this;
+				currentWorker() = index;
+				if (!workerCpus.empty()) pinCurrentThread(workerCpus[index]);
+
+				WorkerQueue& own = *queues[index];
+				std::function<void()> task;
+				while (true) {
+					if (tryGetTask(index, task)) {
+						task();
+						task = nullptr;
+						continue;
+					}
+
+					std::unique_lock<std::mutex> lock(sleepMutex);
+					wakeUp.wait(lock, [&]() { return stopping || numOfQueuedTasks > 0 || own.numOfPinnedTasks > 0; });
+					if (stopping && numOfQueuedTasks == 0 && own.numOfPinnedTasks == 0) return;
+				}
+			}
+
+			void push(int worker, std::function<void()> task, bool pinned) {
+				{
+					std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+					if (pinned) {
+						queues[worker]->pinnedTasks.push_back(std::move(task));
+						queues[worker]->numOfPinnedTasks++;
+					}
+					else {
+						queues[worker]->tasks.push_back(std::move(task));
+						numOfQueuedTasks++;
+					}
+				}
+				std::lock_guard<std::mutex> lock(sleepMutex);
+				if (pinned) wakeUp.notify_all();
+				else wakeUp.notify_one();
+			}
+
+			// Workers run other tasks while they wait, so nested parallel calls can not deadlock. Other threads sleep
+			void wait(TaskGroup& group) {
+				int worker = getCurrentWorkerIndex();
+				if (worker >= 0) {
+					std::function<void()> task;
+					while (group.remaining > 0) {
+						if (tryGetTask(worker, task)) {
+							task();
+							task = nullptr;
+						}
+						else {
+							std::this_thread::yield();
+						}
+					}
+					// Wait for the last finish call to release the mutex
+					std::lock_guard<std::mutex> lock(group.mutex);
+				}
+				else {
+					std::unique_lock<std::mutex> lock(group.mutex);
+					group.done.wait(lock, [&group]() { return group.remaining == 0; });
+				}
+				if (group.error) std::rethrow_exception(group.error);
+			}
+
+		public:
+			ThreadPool(RuntimeSettings settings = RuntimeSettings()) {
+				std::vector<int> cpus = (settings.cpus.empty()) ? getAllowedCpus() : settings.cpus;
+				unsigned int numOfThreads = (settings.numOfThreads == 0) ? cpus.size() : settings.numOfThreads;
+
+				if (settings.pinThreads) {
+					for (unsigned int i = 0; i < numOfThreads; i++) workerCpus.push_back(cpus[i % cpus.size()]);
+				}
+				for (unsigned int i = 0; i < numOfThreads; i++) queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+				for (unsigned int i = 0; i < numOfThreads; i++) workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+			}
+			~ThreadPool() {
+				{
+					std::lock_guard<std::mutex> lock(sleepMutex);
+					stopping = true;
+				}
+				wakeUp.notify_all();
+				for (unsigned int i = 0; i < workers.size(); i++) workers[i].join();
+			}
+			ThreadPool(const ThreadPool&) = delete;
+			ThreadPool& operator=(const ThreadPool&) = delete;
+
+			int getNumOfThreads() const {
+				return workers.size();
+			}
+			// Index of the worker running the calling code, or -1 if it is not running in this pool
+			int getCurrentWorkerIndex() {
+				return (currentPool() == this) ? currentWorker() : -1;
+			}
+			// CPU worker is pinned to, or -1 if threads are not pinned
+			int getWorkerCpu(int worker) const {
+				return (workerCpus.empty()) ? -1 : workerCpus[worker];
+			}
+
+			// Calls body(chunkBegin, chunkEnd) for chunks of at most grainSize indexes covering begin to end - 1, in parallel.
+			// If grainSize is 0, the range is split into a few chunks per worker. Returns once every chunk is done, and rethrows
+			// the first exception thrown by body
+			void parallelFor(int begin, int end, int grainSize, const std::function<void(int chunkBegin, int chunkEnd)>& body) {
+				if (end <= begin) return;
+				if (grainSize <= 0) grainSize = std::max(1, (end - begin) / (4 * std::max(1, getNumOfThreads())));
+
+				int numOfChunks = (end - begin + grainSize - 1) / grainSize;
+				if (numOfChunks == 1 || workers.empty()) {
+					body(begin, end);
+					return;
+				}
+
+				TaskGroup group;
+				group.remaining = numOfChunks;
+
+				// Chunks from outside the pool are dealt out in order, so chunk i of a range starts on the same worker every time.
+				// Chunks from inside the pool go to the calling worker's queue, and idle workers steal them
+				int worker = getCurrentWorkerIndex();
+				for (int c = 0; c < numOfChunks; c++) {
+					int chunkBegin = begin + c * grainSize;
+					int chunkEnd = std::min(end, chunkBegin + grainSize);
+					int target = (worker >= 0) ? worker : c % workers.size();
+
+					push(target, [&group, &body, chunkBegin, chunkEnd]() {
+						try {
+							body(chunkBegin, chunkEnd);
+						}
+						catch (...) {
+							std::lock_guard<std::mutex> lock(group.mutex);
+							if (!group.error) group.error = std::current_exception();
+						}
+						group.finish();
+					}, false);
+				}
+				wait(group);
+			}
+
+			// Runs task(workerIndex) once on every worker thread and waits for all of them. Memory a worker allocates and fills
+			// here is placed on its own NUMA node by the operating system (first touch), so use it to create per-worker buffers
+			void runOnEachWorker(const std::function<void(int workerIndex)>& task) {
+				TaskGroup group;
+				group.remaining = workers.size();
+
+				for (unsigned int w = 0; w < workers.size(); w++) {
+					push(w, [&group, &task, w]() {
+						try {
+							task(w);
+						}
+						catch (...) {
+							std::lock_guard<std::mutex> lock(group.mutex);
+							if (!group.error) group.error = std::current_exception();
+						}
+						group.finish();
+					}, true);
+				}
+				wait(group);
+			}
+		};
+
+		// One T per worker of a pool, each created on the worker that uses it, plus one for the thread that created the
+		// WorkerLocal. That thread runs parallelFor bodies itself when there is only one chunk
+		template <typename T>
+		class WorkerLocal {
+		private:
+			ThreadPool& pool;
+			std::vector<std::unique_ptr<T>> values;
+
+		public:
+			WorkerLocal(ThreadPool& threadPool, const std::function<T*()>& create) : pool(threadPool) {
+				values.resize(pool.getNumOfThreads() + 1);
+				pool.runOnEachWorker([this, &create](int worker) {
+					values[worker].reset(create());
+				});
+				values.back().reset(create());
+			}
+			// Value of the calling worker, or of the creating thread when called outside the pool
+			T& local() {
+				int worker = pool.getCurrentWorkerIndex();
+				return *values[(worker >= 0) ? worker : values.size() - 1];
+			}
+			// Values 0 to size() - 2 belong to the workers, the last one to the creating thread
+			T& get(int index) {
+				return *values[index];
+			}
+			int size() const {
+				return values.size();
+			}
+		};
+
+		// State behind getDefaultPool. The pointer is only written under the mutex, so getDefaultPool only locks until the
+		// pool exists
+		struct DefaultPool {
+			std::mutex mutex;
+			std::atomic<ThreadPool*> pool{ nullptr };
+			std::unique_ptr<ThreadPool> owner;
+		};
+		DefaultPool& getDefaultPoolState() {
+			static DefaultPool state;
+			return state;
+		}
+
+		// Pool used by the rest of the framework. Created with the default settings on first use
+		ThreadPool& getDefaultPool() {
+			DefaultPool& state = getDefaultPoolState();
+			ThreadPool* pool = state.pool.load(std::memory_order_acquire);
+			if (pool != nullptr) return *pool;
+
+			std::lock_guard<std::mutex> lock(state.mutex);
+			if (!state.owner) {
+				state.owner.reset(new ThreadPool());
+				state.pool.store(state.owner.get(), std::memory_order_release);
+			}
+			return *state.owner;
+		}
+
+		// Replaces the pool used by the rest of the framework. Call it before training or running networks, not while they run
+		void configure(RuntimeSettings settings) {
+			std::unique_ptr<ThreadPool> newPool(new ThreadPool(settings));
+			DefaultPool& state = getDefaultPoolState();
+			{
+				std::lock_guard<std::mutex> lock(state.mutex);
+				state.owner.swap(newPool);
+				state.pool.store(state.owner.get(), std::memory_order_release);
+			}
+			// The old pool, now in newPool, is stopped outside the lock
+		}
+	}
+}
@@ -1,11 +1,16 @@
 #pragma once
 #include "neuronnetwork.hpp"
+#include "denselayer.hpp"
 #include "activationfunctions.hpp"
+#include "evaluation.hpp"
+#include "threadpool.hpp"
 #include <vector>
 #include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <ctime>
+#include <future>
+#include <string>
 
 namespace deeplframework {
 	namespace backpropogationTraining {
@@ -215,5 +220,378 @@ namespace deeplframework {
 			// Return newModel
 			return newModel;
 		}
+
+		// Sums the gradient of any number of samples into one row-major weight matrix and one bias vector per layer, in
+		// precision T. GradientAccumulator is the double version
+		template <typename T>
+		class BasicGradientAccumulator {
+		private:
+			std::vector<std::vector<T>> weightGradients;
+			std::vector<std::vector<T>> biasGradients;
+
+		public:
+			BasicGradientAccumulator(std::vector<int> layerShape, int numOfInputs) {
+				int numOfWeights = numOfInputs;
+				for (unsigned int l = 0; l < layerShape.size(); l++) {
+					weightGradients.push_back(std::vector<T>(layerShape[l] * numOfWeights, 0));
+					biasGradients.push_back(std::vector<T>(layerShape[l], 0));
+					numOfWeights = layerShape[l];
+				}
+			}
+			void reset() {
+				for (unsigned int l = 0; l < weightGradients.size(); l++) {
+					std::fill(weightGradients[l].begin(), weightGradients[l].end(), T(0));
+					std::fill(biasGradients[l].begin(), biasGradients[l].end(), T(0));
+				}
+			}
+			// Clears the gradient of neurons firstNeuron to lastNeuron - 1 of a layer
+			void resetNeurons(int layer, int firstNeuron, int lastNeuron) {
+				const int numOfInputs = weightGradients[layer].size() / biasGradients[layer].size();
+				std::fill(weightGradients[layer].begin() + firstNeuron * numOfInputs, weightGradients[layer].begin() + lastNeuron * numOfInputs, T(0));
+				std::fill(biasGradients[layer].begin() + firstNeuron, biasGradients[layer].begin() + lastNeuron, T(0));
+			}
+			// Adds deltas^T * activations to the weight gradient of a layer, and the column sums of deltas to its bias gradient.
+			// Deltas is numOfSamplesInBatch x numOfNeurons and activations is numOfSamplesInBatch x numOfInputs, both row-major.
+			// Only neurons firstNeuron to lastNeuron - 1 are updated (all if lastNeuron is -1), so threads can split the rows
+			void accumulateLayer(int layer, const T* deltas, const T* activations, int numOfSamplesInBatch, int firstNeuron = 0, int lastNeuron = -1) {
+				const int numOfNeurons = biasGradients[layer].size();
+				const int numOfInputs = weightGradients[layer].size() / numOfNeurons;
+				if (lastNeuron < 0) lastNeuron = numOfNeurons;
+
+				for (int n = firstNeuron; n < lastNeuron; n++) {
+					// The gradient row stays in cache while every sample is added to it
+					T* row = &weightGradients[layer][n * numOfInputs];
+					for (int s = 0; s < numOfSamplesInBatch; s++) {
+						T delta = deltas[s * numOfNeurons + n];
+						if (delta == 0) continue;
+
+						biasGradients[layer][n] += delta;
+						const T* activation = activations + s * numOfInputs;
+						for (int i = 0; i < numOfInputs; i++) {
+							row[i] += delta * activation[i];
+						}
+					}
+				}
+			}
+			const std::vector<T>& getWeightGradient(int layer) const {
+				return weightGradients[layer];
+			}
+			const std::vector<T>& getBiasGradient(int layer) const {
+				return biasGradients[layer];
+			}
+		};
+		typedef BasicGradientAccumulator<double> GradientAccumulator;
+
+		// Buffers for up to numOfRows samples, reused between micro-batches so they are only allocated once
+		struct MicroBatchWorkspace {
+			// One row-major matrix per layer, one row per sample
+			std::vector<std::vector<double>> weightedSums;
+			std::vector<std::vector<double>> activations;
+			std::vector<std::vector<double>> deltas;
+
+			MicroBatchWorkspace(std::vector<int> layerShape, int numOfRows) {
+				for (unsigned int l = 0; l < layerShape.size(); l++) {
+					weightedSums.push_back(std::vector<double>(numOfRows * layerShape[l]));
+					activations.push_back(std::vector<double>(numOfRows * layerShape[l]));
+					deltas.push_back(std::vector<double>(numOfRows * layerShape[l]));
+				}
+			}
+		};
+
+		// Runs the forward and backward pass of numOfSamples samples and stores their deltas in rows firstRow to
+		// firstRow + numOfSamples - 1 of the workspace. Inputs and expectedOutputs are row-major, one row per sample. Returns
+		// the summed squared error of the samples
+		double calculateDeltas(const std::vector<DenseLayerParameters>& layers, const double* inputs, const double* expectedOutputs, MicroBatchWorkspace& workspace,
+			int numOfSamples, int firstRow = 0) {
+			const int numOfLayers = layers.size();
+
+			forwardPass(layers, inputs, numOfSamples, workspace.weightedSums, workspace.activations, firstRow);
+
+			// Output layer deltas for the MSE cost function
+			double cost = 0;
+			const DenseLayerParameters& outputLayer = layers.back();
+			const double* outputs = &workspace.activations.back()[firstRow * outputLayer.numOfNeurons];
+			const double* outputSums = &workspace.weightedSums.back()[firstRow * outputLayer.numOfNeurons];
+			double* outputDeltas = &workspace.deltas.back()[firstRow * outputLayer.numOfNeurons];
+			for (int s = 0; s < numOfSamples; s++) {
+				cost += evaluation::squaredError(&outputs[s * outputLayer.numOfNeurons], &expectedOutputs[s * outputLayer.numOfNeurons], outputLayer.numOfNeurons);
+			}
+			for (int j = 0; j < numOfSamples * outputLayer.numOfNeurons; j++) {
+				double difference = outputs[j] - expectedOutputs[j];
+				outputDeltas[j] = outputLayer.activationFunctionDerivative(outputSums[j]) * 2 * difference;
+			}
+
+			// Backward pass: deltas = (deltas of next layer * weights of next layer) .* activation derivative
+			for (int l = numOfLayers - 2; l >= 0; l--) {
+				const DenseLayerParameters& layer = layers[l];
+				const DenseLayerParameters& next = layers[l + 1];
+
+				for (int s = firstRow; s < firstRow + numOfSamples; s++) {
+					double* delta = &workspace.deltas[l][s * layer.numOfNeurons];
+					std::fill(delta, delta + layer.numOfNeurons, 0.0);
+
+					for (int p = 0; p < next.numOfNeurons; p++) {
+						double nextDelta = workspace.deltas[l + 1][s * next.numOfNeurons + p];
+						if (nextDelta == 0) continue;
+
+						const double* weights = &next.weights[p * next.numOfInputs];
+						for (int n = 0; n < layer.numOfNeurons; n++) {
+							delta[n] += weights[n] * nextDelta;
+						}
+					}
+					for (int n = 0; n < layer.numOfNeurons; n++) {
+						delta[n] *= layer.activationFunctionDerivative(workspace.weightedSums[l][s * layer.numOfNeurons + n]);
+					}
+				}
+			}
+
+			return cost;
+		}
+
+		// Runs the forward and backward pass of numOfSamples samples and adds their gradient to the accumulator. Inputs and
+		// expectedOutputs are row-major, one row per sample. Returns the summed squared error of the samples
+		double accumulateMicroBatch(const std::vector<DenseLayerParameters>& layers, const double* inputs, const double* expectedOutputs, MicroBatchWorkspace& workspace,
+			int numOfSamples, GradientAccumulator& accumulator) {
+			double cost = calculateDeltas(layers, inputs, expectedOutputs, workspace, numOfSamples);
+
+			// Weight gradients: deltas^T * activations of previous layer
+			for (unsigned int l = 0; l < layers.size(); l++) {
+				const double* previous = (l == 0) ? inputs : workspace.activations[l - 1].data();
+				accumulator.accumulateLayer(l, workspace.deltas[l].data(), previous, numOfSamples);
+			}
+
+			return cost;
+		}
+
+		// Held-out data for mse_fit_accumulated. The data functions are called from a background thread while training continues,
+		// so they must not share state (e.g. a MnistDataReader) with the training data functions
+		struct ValidationSettings {
+			std::vector<double>(*inputDataGen)(int dataIndex);
+			std::vector<double>(*expectedOutputDataGen)(int dataIndex);
+			int firstSample;
+			int numOfSamples;
+			// Training stops after this many epochs without a better validation accuracy. 0 never stops early
+			int patience = 0;
+		};
+
+		// Number of neurons per parallelFor chunk so that each chunk does about NeuronLayer::PARALLEL_MIN_WEIGHTS multiply-adds,
+		// given the work per neuron. Smaller layers are then handled by the calling thread alone
+		int getNeuronGrainSize(long long workPerNeuron) {
+			return (int)std::max(1LL, NeuronLayer::PARALLEL_MIN_WEIGHTS / std::max(1LL, workPerNeuron));
+		}
+
+		// Parameters, round buffers and gradient of mse_fit_accumulated. The deltas of a round's micro-batches are calculated
+		// in parallel, then the gradient of the whole round is added to a single accumulator with its rows split between the
+		// workers, so there is one gradient however many threads the pool has
+		class AccumulatedTrainer {
+		private:
+			std::vector<DenseLayerParameters> layers;
+			runtime::ThreadPool& pool;
+			GradientAccumulator gradient;
+			MicroBatchWorkspace workspace;
+			std::vector<double> roundInputs;
+			std::vector<double> roundExpectedOutputs;
+			int numOfInputs;
+			int numOfOutputs;
+			double learningRate;
+
+		public:
+			AccumulatedTrainer(NeuralNetwork& model, runtime::ThreadPool& threadPool, int samplesPerRound, double learningRate)
+				: pool(threadPool), gradient(model.getLayerShape(), model.getNumOfInputs()), workspace(model.getLayerShape(), samplesPerRound) {
+				std::vector<NeuronLayer> modelLayers = model.getLayers();
+				for (unsigned int l = 0; l < modelLayers.size(); l++) {
+					layers.push_back(DenseLayerParameters(modelLayers[l]));
+				}
+				this->numOfInputs = model.getNumOfInputs();
+				this->numOfOutputs = layers.back().numOfNeurons;
+				this->learningRate = learningRate;
+				roundInputs.resize(samplesPerRound * numOfInputs);
+				roundExpectedOutputs.resize(samplesPerRound * numOfOutputs);
+			}
+			// Copies one sample into row row of the round
+			void loadSample(int row, const std::vector<double>& inputs, const std::vector<double>& expectedOutputs) {
+				std::copy(inputs.begin(), inputs.end(), roundInputs.begin() + row * numOfInputs);
+				std::copy(expectedOutputs.begin(), expectedOutputs.end(), roundExpectedOutputs.begin() + row * numOfOutputs);
+			}
+			// Forward and backward pass of rows firstRow to firstRow + numOfSamples - 1. Calls for different rows may run in
+			// parallel. Returns the summed squared error of the samples
+			double runMicroBatch(int firstRow, int numOfSamples) {
+				return calculateDeltas(layers, &roundInputs[firstRow * numOfInputs], &roundExpectedOutputs[firstRow * numOfOutputs], workspace, numOfSamples, firstRow);
+			}
+			// Adds the gradient of the first numOfSamples rows of the round
+			void accumulate(int numOfSamples) {
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					const double* previous = (l == 0) ? roundInputs.data() : workspace.activations[l - 1].data();
+					int grainSize = getNeuronGrainSize((long long)layers[l].numOfInputs * numOfSamples);
+					pool.parallelFor(0, layers[l].numOfNeurons, grainSize, [&](int firstNeuron, int lastNeuron) {
+						gradient.accumulateLayer(l, workspace.deltas[l].data(), previous, numOfSamples, firstNeuron, lastNeuron);
+					});
+				}
+			}
+			// Text added to the progress update of a mini-batch
+			std::string getStatus() const {
+				return "";
+			}
+			// Moves the layers by the average gradient of the mini-batch and clears the gradient
+			void update(int samplesPerBatch) {
+				const double learningRateTimesRofNumSamples = learningRate * (1.0 / (double)samplesPerBatch);
+
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					DenseLayerParameters& layer = layers[l];
+					const std::vector<double>& weightGradient = gradient.getWeightGradient(l);
+					const std::vector<double>& biasGradient = gradient.getBiasGradient(l);
+
+					pool.parallelFor(0, layer.numOfNeurons, getNeuronGrainSize(layer.numOfInputs), [&](int firstNeuron, int lastNeuron) {
+						for (int i = firstNeuron * layer.numOfInputs; i < lastNeuron * layer.numOfInputs; i++) {
+							layer.weights[i] -= learningRateTimesRofNumSamples * weightGradient[i];
+						}
+						for (int n = firstNeuron; n < lastNeuron; n++) {
+							layer.biases[n] -= learningRateTimesRofNumSamples * biasGradient[n];
+						}
+						gradient.resetNeurons(l, firstNeuron, lastNeuron);
+					});
+				}
+			}
+			int getNumOfInputs() const {
+				return numOfInputs;
+			}
+			int getNumOfOutputs() const {
+				return numOfOutputs;
+			}
+			// Converts the layers being trained back into a network
+			NeuralNetwork toNeuralNetwork() const {
+				std::vector<NeuronLayer> trainedLayers;
+				for (unsigned int l = 0; l < layers.size(); l++) {
+					trainedLayers.push_back(layers[l].toNeuronLayer());
+				}
+				return NeuralNetwork(trainedLayers, numOfInputs);
+			}
+		};
+
+		// Epoch, mini-batch and validation loop shared by the batched trainers. Every mini-batch is split into rounds of
+		// samplesPerRound samples, which are loaded on this thread, since the data functions may not be thread safe, and then
+		// passed to the trainer one microBatchSize micro-batch per parallelFor chunk. Trainer provides loadSample,
+		// runMicroBatch, accumulate, getStatus, update, getNumOfInputs, getNumOfOutputs and toNeuralNetwork like
+		// AccumulatedTrainer. If validation is given, the model after each epoch is evaluated in the background during the next
+		// epoch, and the model with the best validation accuracy is returned
+		template <typename Trainer>
+		NeuralNetwork trainInRounds(Trainer& trainer, runtime::ThreadPool& pool, const int samplesPerRound, const int numOfMiniBatches, const int numOfTrainingSamples,
+			std::vector<double>(*inputTrainingDataGen)(int dataIndex), std::vector<double>(*expectedOutputDataGen)(int dataIndex), const int epochs, const int microBatchSize,
+			const bool showUpdates, const ValidationSettings* validation) {
+
+			const int samplesPerBatch = numOfTrainingSamples / numOfMiniBatches;
+			const int numOfInputs = trainer.getNumOfInputs();
+			const int numOfOutputs = trainer.getNumOfOutputs();
+
+			// Cost of every micro-batch of a round, summed in order so the printed cost does not depend on scheduling
+			std::vector<double> microBatchCosts((samplesPerRound + microBatchSize - 1) / microBatchSize);
+
+			// Validation state. pendingValidation holds the evaluation of pendingModel, which was trained for pendingEpoch epochs
+			std::future<evaluation::EvaluationResult> pendingValidation;
+			NeuralNetwork pendingModel;
+			int pendingEpoch = 0;
+			NeuralNetwork bestModel;
+			double bestAccuracy = -1;
+			int bestEpoch = 0;
+
+			// Waits for the pending evaluation. Returns true if training should stop
+			auto collectValidation = [&]() {
+				evaluation::EvaluationResult result = pendingValidation.get();
+				if (showUpdates) {
+					std::cout << "Epoch: " << pendingEpoch << "\tValidation cost: " << result.loss << "\tValidation accuracy: " << result.accuracy << "\n";
+				}
+				if (result.accuracy > bestAccuracy) {
+					bestAccuracy = result.accuracy;
+					bestModel = pendingModel;
+					bestEpoch = pendingEpoch;
+				}
+				return validation->patience > 0 && pendingEpoch - bestEpoch >= validation->patience;
+			};
+
+			for (int e = 1; e <= epochs; e++) {
+				std::vector<int> batches = generateRandomSampleIds(0, numOfMiniBatches);
+				int batchesCompleted = 0;
+
+				for (int batch : batches) {
+					double cost = 0;
+					double timeStarted = std::time(nullptr);
+
+					std::vector<int> sampleids = generateRandomSampleIds(samplesPerBatch * batch, samplesPerBatch * (batch + 1));
+
+					for (unsigned int first = 0; first < sampleids.size(); first += samplesPerRound) {
+						int numOfSamples = std::min<int>(samplesPerRound, sampleids.size() - first);
+
+						for (int s = 0; s < numOfSamples; s++) {
+							std::vector<double> inputs = inputTrainingDataGen(sampleids[first + s]);
+							std::vector<double> expectedOutputs = expectedOutputDataGen(sampleids[first + s]);
+							if ((int)inputs.size() != numOfInputs || (int)expectedOutputs.size() != numOfOutputs) {
+								throw std::runtime_error("Training data does not match the network shape");
+							}
+							trainer.loadSample(s, inputs, expectedOutputs);
+						}
+
+						int numOfMicroBatches = (numOfSamples + microBatchSize - 1) / microBatchSize;
+						pool.parallelFor(0, numOfMicroBatches, 1, [&](int firstMicroBatch, int lastMicroBatch) {
+							for (int m = firstMicroBatch; m < lastMicroBatch; m++) {
+								int firstRow = m * microBatchSize;
+								microBatchCosts[m] = trainer.runMicroBatch(firstRow, std::min(microBatchSize, numOfSamples - firstRow));
+							}
+						});
+						for (int m = 0; m < numOfMicroBatches; m++) cost += microBatchCosts[m];
+
+						trainer.accumulate(numOfSamples);
+					}
+
+					if (showUpdates) {
+						cost /= (double)samplesPerBatch;
+						std::cout << "Epoch: " << e << "\tBatch: " << ++batchesCompleted << "\tCost: " << cost << "\t";
+						std::cout << "Time elapsed: " << std::time(nullptr) - timeStarted << "s\t";
+						std::cout << "Samples: " << samplesPerBatch << trainer.getStatus() << "\n";
+					}
+
+					trainer.update(samplesPerBatch);
+				}
+
+				if (validation != nullptr) {
+					// The previous epoch's evaluation ran while this epoch trained
+					if (pendingValidation.valid() && collectValidation()) {
+						return bestModel;
+					}
+					pendingModel = trainer.toNeuralNetwork();
+					pendingEpoch = e;
+					pendingValidation = evaluation::evaluateAsync(pendingModel, validation->firstSample, validation->numOfSamples,
+						validation->inputDataGen, validation->expectedOutputDataGen);
+				}
+			}
+
+			if (validation != nullptr && pendingValidation.valid()) {
+				collectValidation();
+				return bestModel;
+			}
+			return trainer.toNeuralNetwork();
+		}
+
+		// Same training as mse_fit, but every mini-batch is processed microBatchSize samples at a time. The gradient of a
+		// micro-batch is computed with matrix products, so no per-sample gradient is created. Micro-batches run in parallel on
+		// the runtime thread pool, and their gradients are summed into one accumulator. Memory use does not depend on
+		// numOfTrainingSamples / numOfMiniBatches, so mini-batches can be large. It is one copy of the parameters for the
+		// gradient plus threads x microBatchSize x (inputs + outputs + 3 x layer widths) for the round buffers.
+		// If validation is given, the model after each epoch is evaluated in the background during the next epoch, and the
+		// model with the best validation accuracy is returned
+		NeuralNetwork mse_fit_accumulated(NeuralNetwork& model, const int numOfMiniBatches, const int numOfTrainingSamples, std::vector<double>(*inputTrainingDataGen)(int dataIndex),
+			std::vector<double>(*expectedOutputDataGen)(int dataIndex), const int epochs = 11, const double learningRate = 0.1, const int microBatchSize = 32, const bool showUpdates = true,
+			const ValidationSettings* validation = nullptr) {
+
+			if (microBatchSize <= 0) {
+				throw std::runtime_error("Micro-batch size must be positive");
+			}
+
+			runtime::ThreadPool& pool = runtime::getDefaultPool();
+			const int samplesPerRound = std::max(1, pool.getNumOfThreads()) * microBatchSize;
+			AccumulatedTrainer trainer(model, pool, samplesPerRound, learningRate);
+
+			return trainInRounds(trainer, pool, samplesPerRound, numOfMiniBatches, numOfTrainingSamples, inputTrainingDataGen, expectedOutputDataGen, epochs,
+				microBatchSize, showUpdates, validation);
+		}
 	}
 }